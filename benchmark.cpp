@@ -0,0 +1,383 @@
+﻿#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <atomic>
+#include <new>
+#include <random>
+
+#include "readwrite_data.h"
+
+// Benchmarks for the hot paths of readwrite_data.h, build with: g++ -std=c++17 -O2 -pthread benchmark.cpp
+// Each benchmark runs until it has taken at least [min_time], then prints its throughput and the heap allocations it made per run.
+// Results can be saved to a simple text notation file, and later runs compared with them to find regressions.
+
+static std::atomic<size_t> allocations{ 0 };
+
+// All allocation functions are replaced, so that each one pairs malloc and free (or their aligned versions) directly.
+void* counted_malloc(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if (void* p = malloc((size) ? size : 1)) {
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* counted_aligned_malloc(size_t size, std::align_val_t alignment)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	size_t align = (size_t)alignment;
+
+#if defined(_WIN32)
+	void* p = _aligned_malloc((size) ? size : 1, align);
+#else
+	void* p = nullptr;
+
+	if (posix_memalign(&p, std::max(align, sizeof(void*)), (size) ? size : 1) != 0)
+		p = nullptr;
+#endif
+
+	if (p) {
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void aligned_free(void* p)
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void* operator new(size_t size) { return counted_malloc(size); }
+void* operator new[](size_t size) { return counted_malloc(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+void* operator new(size_t size, std::align_val_t alignment) { return counted_aligned_malloc(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_aligned_malloc(size, alignment); }
+void operator delete(void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { aligned_free(p); }
+
+static const std::chrono::duration<double> min_time(0.25);
+static const char* filter = "";
+static volatile size_t sink;
+
+// Results as "microseconds allocations" per run for each benchmark name, of this run and of the run to compare with.
+static std::map<std::string, std::string> results, saved;
+static const double max_slowdown = 1.25;
+static int regressions = 0;
+
+// Run [body] repeatedly, it processes [bytes] bytes per run.
+template<typename Body>
+void bench(const std::string& name, size_t bytes, Body&& body)
+{
+	if (name.find(filter) == std::string::npos) {
+		return;
+	}
+
+	using clock = std::chrono::steady_clock;
+
+	size_t runs = 0;
+	size_t allocs = allocations.load();
+	clock::time_point start = clock::now();
+	std::chrono::duration<double> elapsed(0);
+
+	do {
+		sink = body();
+		runs++;
+		elapsed = clock::now() - start;
+	} while (elapsed < min_time);
+
+	allocs = allocations.load() - allocs;
+
+	double per_run = elapsed.count() / runs;
+	double mb_per_s = bytes / per_run / (1024 * 1024);
+
+	double us = per_run * 1e6, allocs_per_run = (double)allocs / runs;
+	auto it = saved.find(name);
+
+	printf("%-48s %12.3f us %12.1f MB/s %10.1f allocs/run", name.c_str(), us, mb_per_s, allocs_per_run);
+
+	// Slower runs by more than [max_slowdown], or one more allocation in every other run, count as regressions.
+	if (it != saved.end()) {
+		double saved_us = 0, saved_allocs = 0;
+
+		sscanf(it->second.c_str(), "%lf %lf", &saved_us, &saved_allocs);
+
+		if (saved_us > 0)
+			printf(" %+8.1f%%", (us / saved_us - 1) * 100);
+
+		if (us > saved_us * max_slowdown || allocs_per_run >= saved_allocs + 0.5) {
+			printf(" REGRESSION");
+			regressions++;
+		}
+	}
+
+	printf("\n");
+
+	char result[64];
+	snprintf(result, sizeof(result), "%.3f %.1f", us, allocs_per_run);
+	results[name] = result;
+}
+
+// Random printable text with words and newlines.
+std::string make_text(size_t size, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::string str(size, ' ');
+
+	for (char& c : str) {
+		unsigned r = rng() % 64;
+		c = (r < 50) ? char('a' + r % 26) : (r < 62) ? ' ' : '\n';
+	}
+
+	return str;
+}
+
+// Simple text notation with plain, empty, commented and multiline attributes, about [size] bytes long.
+std::string make_stn(size_t size, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::string str;
+
+	str.reserve(size + 256);
+
+	while (str.size() < size) {
+		unsigned r = rng() % 16;
+		std::string name = "attribute_" + std::to_string(rng() % 100000);
+
+		if (r == 0) {
+			str += "# comment line\n";
+		}
+		else if (r == 1) {
+			str += name + "\n\n";
+		}
+		else if (r == 2) {
+			str += name + "\n[MULTILINE]\nfirst line\n\nthird line\n[END_MULTILINE]\n\n";
+		}
+		else {
+			str += name + "\nvalue " + std::to_string(rng()) + "\n\n";
+		}
+	}
+
+	return str;
+}
+
+std::string size_name(size_t size)
+{
+	return (size >= (1 << 20)) ? std::to_string(size >> 20) + "MB" : std::to_string(size >> 10) + "KB";
+}
+
+void bench_find_sequence()
+{
+	for (size_t haystack_size : { 1 << 10, 1 << 20, 16 << 20 }) {
+		std::string haystack = make_text(haystack_size, 1);
+
+		for (size_t needle_size : { 1, 4, 16, 64, 256 }) {
+			// Not in the text, so the whole haystack is scanned.
+			std::string needle(needle_size, 'x');
+			needle[0] = '#';
+
+			bench("find_sequence/" + size_name(haystack_size) + "/needle " + std::to_string(needle_size), haystack_size, [&]() {
+				return rw::find_sequence(haystack.data(), haystack.size(), needle.data(), needle.size());
+			});
+		}
+
+		// Adversarial: every position matches all but the last byte.
+		std::string same(haystack_size, 'a');
+
+		for (size_t needle_size : { 16, 64 }) {
+			std::string needle(needle_size - 1, 'a');
+			needle += 'b';
+
+			bench("find_sequence/" + size_name(haystack_size) + "/adversarial " + std::to_string(needle_size), haystack_size, [&]() {
+				return rw::find_sequence(same.data(), same.size(), needle.data(), needle.size());
+			});
+		}
+	}
+}
+
+void bench_streams()
+{
+	const size_t size = 16 << 20;
+	std::string data = make_text(size, 2);
+	std::string dest(size, '\0');
+
+	for (size_t chunk : { 8, 64, 4096 }) {
+		bench("ReadStream::read/chunk " + std::to_string(chunk), size, [&]() {
+			rw::ReadStream rs(data.data(), data.size());
+			size_t total = 0;
+
+			while (rs)
+				total += rs.read(dest.data(), chunk);
+
+			return total;
+		});
+	}
+
+	bench("ReadStream::read<uint32_t>", size, [&]() {
+		rw::ReadStream rs(data.data(), data.size());
+		uint32_t sum = 0;
+
+		while (rs)
+			sum += rs.read<uint32_t>();
+
+		return (size_t)sum;
+	});
+
+	bench("ReadStream::readWhile/lines", size, [&]() {
+		rw::ReadStream rs(data.data(), data.size());
+		size_t lines = 0;
+
+		while (rs)
+			lines += rs.readWhile([](char c) { return c != '\n'; }).size();
+
+		return lines;
+	});
+
+	bench("ReadStream::readLine", size, [&]() {
+		rw::ReadStream rs(data.data(), data.size());
+		size_t lines = 0;
+
+		while (rs)
+			lines += rs.readLine().size();
+
+		return lines;
+	});
+
+	bench("WriteStream::write<uint32_t>", size, [&]() {
+		rw::WriteStream ws;
+
+		for (uint32_t i = 0; i < size / 4; i++)
+			ws.write(i);
+
+		return ws.size();
+	});
+
+	bench("WriteStream::write/chunk 64", size, [&]() {
+		rw::WriteStream ws;
+
+		for (size_t i = 0; i < size; i += 64)
+			ws.write(data.data() + i, 64);
+
+		return ws.size();
+	});
+
+	bench("WriteStream::put", size, [&]() {
+		rw::WriteStream ws;
+
+		for (size_t i = 0; i < size; i++)
+			ws.put((uint8_t)data[i]);
+
+		return ws.size();
+	});
+}
+
+void bench_parse(size_t max_size)
+{
+	for (size_t size = 1 << 10; size <= max_size; size *= 16) {
+		std::string stn = make_stn(size, 3);
+		rw::ReadStream rs(stn.data(), stn.size());
+
+		bench("stn::parse/" + size_name(size), stn.size(), [&]() { return stn::parse(rs).size(); });
+		bench("stn::parse_view/" + size_name(size), stn.size(), [&]() { return stn::parse_view(rs).size(); });
+		bench("stn::parse_parallel/" + size_name(size), stn.size(), [&]() { return stn::parse_parallel(rs).size(); });
+	}
+}
+
+void bench_files()
+{
+	const char* name = "benchmark_tmp.bin";
+	const size_t size = 64 << 20;
+	std::string data = make_text(size, 4);
+
+	bench("writefile/" + size_name(size), size, [&]() {
+		rw::writefile(name, data.data(), data.size());
+		return data.size();
+	});
+
+	bench("readfile/" + size_name(size), size, [&]() { return rw::readfile(name, true).size(); });
+	bench("MappedFile/" + size_name(size), size, [&]() {
+		rw::MappedFile file(name);
+		size_t lines = 0;
+
+		for (rw::ReadStream rs = file.stream(); rs;)
+			lines += rs.readLine().size();
+
+		return lines;
+	});
+
+	remove(name);
+}
+
+int main(int argc, char** argv)
+{
+	const char* save_name = nullptr;
+	const char* compare_name = nullptr;
+	std::vector<const char*> args;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--save") == 0)
+			save_name = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "--compare") == 0)
+			compare_name = argv[++i];
+		else
+			args.push_back(argv[i]);
+	}
+
+	if (args.size() > 2) {
+		std::cout << "USAGE: " << argv[0] << " [--save file] [--compare file] [filter] [max_parse_size]\n";
+		std::cout << "Runs the benchmarks whose names contain [filter], parsing generated notation files of up to [max_parse_size] bytes (default 64 MB, up to 1 GB).\n";
+		std::cout << "--save writes the results to [file]. --compare marks the benchmarks that are more than 25% slower, or allocate more, than the results in [file], and exits with 1 if there are any.";
+		return 0;
+	}
+
+	size_t max_size = 64 << 20;
+
+	if (args.size() > 0)
+		filter = args[0];
+
+	if (args.size() > 1)
+		max_size = std::min<size_t>(std::strtoull(args[1], nullptr, 10), 1ull << 30);
+
+	if (compare_name) {
+		saved = stn::parse(compare_name);
+
+		if (saved.empty()) {
+			printf("No results to compare with in %s\n", compare_name);
+			return 1;
+		}
+	}
+
+	bench_find_sequence();
+	bench_streams();
+	bench_parse(max_size);
+	bench_files();
+
+	if (save_name && !stn::write(save_name, results)) {
+		printf("Cannot write the results to %s\n", save_name);
+		return 1;
+	}
+
+	if (regressions) {
+		printf("%d regressions\n", regressions);
+		return 1;
+	}
+
+	return 0;
+}
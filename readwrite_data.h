@@ -8,6 +8,98 @@
 #include <string>
 #include <functional>
 #include <map>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <string_view>
+#include <algorithm>
+#include <memory>
+#include <array>
+#include <optional>
+#include <charconv>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <future>
+#include <system_error>
+#include <stdexcept>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <cerrno>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#if __has_include(<span>)
+#include <span>
+#endif
+
+// SIMD instruction sets used by the byte search and varint decoding, picked from the compiler target.
+#if defined(__AVX2__)
+#define RW_AVX2
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#define RW_SSSE3
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RW_SSE2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define RW_NEON
+#include <arm_neon.h>
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define RW_NEON64
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Native file APIs, used for memory mapping and unbuffered file descriptors.
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#if defined(__linux__) || defined(__FreeBSD__)
+#define RW_HAS_PREADV
+#endif
+#if defined(__linux__)
+#define RW_INOTIFY
+#include <sys/inotify.h>
+#include <poll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define RW_KQUEUE
+#include <sys/event.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define RW_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
 
 // Visual Studio does not like fopen.
 #if defined(_MSC_VER)
@@ -17,8 +109,331 @@
 namespace rw
 {
 
+// Instrumentation of the hot paths: stream traffic, searches, parsing and file I/O.
+// It is compiled out unless RW_INSTRUMENT is defined before including this file, then the counters are relaxed atomics shared by all threads.
+// Read the counters with stats(), or get a callback for every file operation with set_io_hook() to feed a profiler or a metrics exporter.
+
+// Kinds of timed file operations.
+enum class IOOp : unsigned
+{
+	open,
+	read,
+	write,
+	sync,
+	map,
+	count // Number of kinds.
+};
+
+// Values of the instrumentation counters, all zero if RW_INSTRUMENT is not defined.
+struct Stats
+{
+	uint64_t bytes_read = 0; // Read from ReadStream and StreamReader.
+	uint64_t bytes_written = 0; // Written to WriteStream.
+	uint64_t find_calls = 0; // Calls of find_sequence().
+	uint64_t find_comparisons = 0; // Candidate positions compared against the whole sequence.
+	uint64_t parse_lines = 0;
+	uint64_t parse_keys = 0; // Attributes that got a value.
+	uint64_t parse_multiline = 0; // Multiline values.
+
+	// File operations by IOOp: number of calls, bytes transferred and total time.
+	// Note: A read or write is one call even if it takes several system calls to transfer everything.
+	uint64_t io_calls[(size_t)IOOp::count] = {};
+	uint64_t io_bytes[(size_t)IOOp::count] = {};
+	uint64_t io_nanoseconds[(size_t)IOOp::count] = {};
+};
+
+// A finished file operation, passed to the hook set with set_io_hook().
+struct IOEvent
+{
+	IOOp op;
+	uint64_t bytes;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::nanoseconds duration;
+};
+
+using IOHook = void(*)(const IOEvent& event);
+
+namespace detail
+{
+
+#if defined(RW_INSTRUMENT)
+struct Counters
+{
+	std::atomic<uint64_t> bytes_read{ 0 };
+	std::atomic<uint64_t> bytes_written{ 0 };
+	std::atomic<uint64_t> find_calls{ 0 };
+	std::atomic<uint64_t> find_comparisons{ 0 };
+	std::atomic<uint64_t> parse_lines{ 0 };
+	std::atomic<uint64_t> parse_keys{ 0 };
+	std::atomic<uint64_t> parse_multiline{ 0 };
+	std::atomic<uint64_t> io_calls[(size_t)IOOp::count] = {};
+	std::atomic<uint64_t> io_bytes[(size_t)IOOp::count] = {};
+	std::atomic<uint64_t> io_nanoseconds[(size_t)IOOp::count] = {};
+	std::atomic<IOHook> hook{ nullptr };
+};
+
+Counters& counters()
+{
+	static Counters c;
+	return c;
+}
+
+#define RW_COUNT(counter, n) (rw::detail::counters().counter.fetch_add((uint64_t)(n), std::memory_order_relaxed))
+#else
+#define RW_COUNT(counter, n) ((void)0)
+#endif
+
+// Times a file operation from construction to destruction and adds up the bytes given to done().
+// Does nothing if RW_INSTRUMENT is not defined.
+struct IOScope
+{
+#if defined(RW_INSTRUMENT)
+	IOScope(IOOp op) : op(op), start(std::chrono::steady_clock::now()) {}
+
+	~IOScope()
+	{
+		IOEvent event{ op, bytes, start, std::chrono::steady_clock::now() - start };
+		Counters& c = counters();
+
+		c.io_calls[(size_t)op].fetch_add(1, std::memory_order_relaxed);
+		c.io_bytes[(size_t)op].fetch_add(bytes, std::memory_order_relaxed);
+		c.io_nanoseconds[(size_t)op].fetch_add((uint64_t)event.duration.count(), std::memory_order_relaxed);
+
+		if (IOHook hook = c.hook.load(std::memory_order_acquire))
+			hook(event);
+	}
+
+	void done(uint64_t num_bytes) { bytes += num_bytes; }
+
+	IOOp op;
+	uint64_t bytes = 0;
+	std::chrono::steady_clock::time_point start;
+#else
+	IOScope(IOOp) {}
+	void done(uint64_t) {}
+#endif
+};
+
+} // namespace detail
+
+// Get the current values of the instrumentation counters.
+Stats stats()
+{
+	Stats s;
+
+#if defined(RW_INSTRUMENT)
+	const detail::Counters& c = detail::counters();
+
+	s.bytes_read = c.bytes_read.load(std::memory_order_relaxed);
+	s.bytes_written = c.bytes_written.load(std::memory_order_relaxed);
+	s.find_calls = c.find_calls.load(std::memory_order_relaxed);
+	s.find_comparisons = c.find_comparisons.load(std::memory_order_relaxed);
+	s.parse_lines = c.parse_lines.load(std::memory_order_relaxed);
+	s.parse_keys = c.parse_keys.load(std::memory_order_relaxed);
+	s.parse_multiline = c.parse_multiline.load(std::memory_order_relaxed);
+
+	for (size_t i = 0; i < (size_t)IOOp::count; i++) {
+		s.io_calls[i] = c.io_calls[i].load(std::memory_order_relaxed);
+		s.io_bytes[i] = c.io_bytes[i].load(std::memory_order_relaxed);
+		s.io_nanoseconds[i] = c.io_nanoseconds[i].load(std::memory_order_relaxed);
+	}
+#endif
+
+	return s;
+}
+
+// Set all instrumentation counters to zero.
+void reset_stats()
+{
+#if defined(RW_INSTRUMENT)
+	detail::Counters& c = detail::counters();
+
+	for (std::atomic<uint64_t>* counter : { &c.bytes_read, &c.bytes_written, &c.find_calls, &c.find_comparisons, &c.parse_lines, &c.parse_keys, &c.parse_multiline })
+		counter->store(0, std::memory_order_relaxed);
+
+	for (size_t i = 0; i < (size_t)IOOp::count; i++) {
+		c.io_calls[i].store(0, std::memory_order_relaxed);
+		c.io_bytes[i].store(0, std::memory_order_relaxed);
+		c.io_nanoseconds[i].store(0, std::memory_order_relaxed);
+	}
+#endif
+}
+
+// Set a function called after every timed file operation, or nullptr to remove it.
+// The hook is called on the thread that did the operation, it has to be thread-safe if files are used from several threads.
+// Note: Does nothing if RW_INSTRUMENT is not defined.
+void set_io_hook(IOHook hook)
+{
+#if defined(RW_INSTRUMENT)
+	detail::counters().hook.store(hook, std::memory_order_release);
+#else
+	(void)hook;
+#endif
+}
+
+namespace detail
+{
+
+#if defined(_MSC_VER)
+unsigned ctz32(uint32_t x) { unsigned long i; _BitScanForward(&i, x); return (unsigned)i; }
+#else
+unsigned ctz32(uint32_t x) { return (unsigned)__builtin_ctz(x); }
+#endif
+
+// Scan [h + from; h + hsize) for [n] with memchr on the first byte.
+// Requires 0 < nsize <= hsize.
+size_t find_bytes_scalar(const uint8_t* h, size_t hsize, const uint8_t* n, size_t nsize, size_t from)
+{
+	const size_t last = hsize - nsize;
+
+	while (from <= last) {
+		const uint8_t* p = (const uint8_t*)memchr(h + from, n[0], last - from + 1);
+
+		if (!p) {
+			break;
+		}
+
+		from = p - h;
+		RW_COUNT(find_comparisons, 1);
+
+		if (memcmp(p + 1, n + 1, nsize - 1) == 0) {
+			return from;
+		}
+
+		from++;
+	}
+
+	return hsize;
+}
+
+// Boyer-Moore-Horspool search, used for long sequences where skipping ahead beats filtering every position.
+// Requires 0 < nsize <= hsize.
+size_t find_bytes_horspool(const uint8_t* h, size_t hsize, const uint8_t* n, size_t nsize)
+{
+	size_t shift[256];
+
+	for (size_t& s : shift)
+		s = nsize;
+
+	for (size_t i = 0; i + 1 < nsize; i++)
+		shift[n[i]] = nsize - 1 - i;
+
+	const uint8_t n_last = n[nsize - 1];
+
+	for (size_t i = 0; i <= hsize - nsize;) {
+		uint8_t c = h[i + nsize - 1];
+
+		if (c == n_last) {
+			RW_COUNT(find_comparisons, 1);
+
+			if (memcmp(h + i, n, nsize - 1) == 0) {
+				return i;
+			}
+		}
+
+		i += shift[c];
+	}
+
+	return hsize;
+}
+
+// Byte sequence search with the same return values as find_sequence().
+// Candidate positions are filtered by comparing the first and last bytes of [n] against a whole vector of positions at once.
+size_t find_bytes(const uint8_t* h, size_t hsize, const uint8_t* n, size_t nsize)
+{
+	if (nsize == 0) {
+		return 0;
+	}
+
+	if (nsize > hsize) {
+		return hsize;
+	}
+
+	if (nsize == 1) {
+		const void* p = memchr(h, n[0], hsize);
+		return (p) ? (const uint8_t*)p - h : hsize;
+	}
+
+	if (nsize >= 32) {
+		return find_bytes_horspool(h, hsize, n, nsize);
+	}
+
+	size_t i = 0;
+
+#if defined(RW_AVX2)
+	{
+		const __m256i first = _mm256_set1_epi8((char)n[0]);
+		const __m256i last = _mm256_set1_epi8((char)n[nsize - 1]);
+
+		for (; i + nsize + 31 <= hsize; i += 32) {
+			__m256i bf = _mm256_loadu_si256((const __m256i*)(h + i));
+			__m256i bl = _mm256_loadu_si256((const __m256i*)(h + i + nsize - 1));
+			uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+
+			for (; mask; mask &= mask - 1) {
+				size_t at = i + ctz32(mask);
+				RW_COUNT(find_comparisons, 1);
+
+				if (memcmp(h + at + 1, n + 1, nsize - 2) == 0) {
+					return at;
+				}
+			}
+		}
+	}
+#endif
+
+#if defined(RW_SSE2)
+	{
+		const __m128i first = _mm_set1_epi8((char)n[0]);
+		const __m128i last = _mm_set1_epi8((char)n[nsize - 1]);
+
+		for (; i + nsize + 15 <= hsize; i += 16) {
+			__m128i bf = _mm_loadu_si128((const __m128i*)(h + i));
+			__m128i bl = _mm_loadu_si128((const __m128i*)(h + i + nsize - 1));
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+
+			for (; mask; mask &= mask - 1) {
+				size_t at = i + ctz32(mask);
+				RW_COUNT(find_comparisons, 1);
+
+				if (memcmp(h + at + 1, n + 1, nsize - 2) == 0) {
+					return at;
+				}
+			}
+		}
+	}
+#elif defined(RW_NEON)
+	{
+		const uint8x16_t first = vdupq_n_u8(n[0]);
+		const uint8x16_t last = vdupq_n_u8(n[nsize - 1]);
+
+		for (; i + nsize + 15 <= hsize; i += 16) {
+			uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(h + i), first), vceqq_u8(vld1q_u8(h + i + nsize - 1), last));
+
+			// Narrow to 4 bits per byte, there is no movemask on NEON.
+			uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+			for (size_t b = 0; mask; b++, mask >>= 4) {
+				if (mask & 0xF) {
+					RW_COUNT(find_comparisons, 1);
+
+					if (memcmp(h + i + b + 1, n + 1, nsize - 2) == 0) {
+						return i + b;
+					}
+				}
+			}
+		}
+	}
+#endif
+
+	return find_bytes_scalar(h, hsize, n, nsize, i);
+}
+
+} // namespace detail
+
 // Find a sub-sequence in a sequence of objects.
 // Type <T> must have operator==.
+// Sequences of 1-byte integers (char, uint8_t, ...) and std::byte are searched with SIMD.
 // Returns:
 // - 0 if the sequence is empty.
 // - [container_size] if the sequence is not found.
@@ -30,325 +445,6036 @@ size_t find_sequence(
 	const T* seq_start,
 	size_t seq_size
 ) {
-	if (seq_size == 0) {
-		return 0;
+	RW_COUNT(find_calls, 1);
+
+	if constexpr (sizeof(T) == 1 && (std::is_integral_v<T> || std::is_same_v<T, std::byte>)) {
+		return detail::find_bytes((const uint8_t*)container_start, container_size, (const uint8_t*)seq_start, seq_size);
+	}
+	else {
+		if (seq_size == 0) {
+			return 0;
+		}
+
+		for (size_t found = 0; found + seq_size <= container_size; found++) {
+			size_t matched_size = 0;
+			RW_COUNT(find_comparisons, 1);
+
+			while (matched_size < seq_size && container_start[found + matched_size] == seq_start[matched_size]) {
+				matched_size++;
+			}
+
+			if (matched_size == seq_size) {
+				return found;
+			}
+		}
+
+		return container_size;
+	}
+}
+
+// Size, modification time and type of a file, taken from one stat call.
+struct FileInfo
+{
+	bool exists = false;
+	bool directory = false;
+	bool regular = false; // A regular file, not a directory, device or pipe.
+	uint64_t size = 0;
+	int64_t mtime = 0; // Nanoseconds since the Unix epoch.
+
+	operator bool() const { return exists; }
+};
+
+namespace detail
+{
+
+#if defined(_WIN32)
+// FILETIME counts 100 nanosecond ticks since 1601.
+int64_t unix_nanoseconds(FILETIME time)
+{
+	int64_t ticks = (int64_t)(((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime);
+	return (ticks - 116444736000000000ll) * 100;
+}
+
+FileInfo file_info(DWORD attributes, FILETIME last_write, DWORD size_high, DWORD size_low)
+{
+	FileInfo info;
+	info.exists = true;
+	info.directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	info.regular = (attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
+	info.size = ((uint64_t)size_high << 32) | size_low;
+	info.mtime = unix_nanoseconds(last_write);
+	return info;
+}
+#else
+FileInfo file_info(const struct stat& st)
+{
+	FileInfo info;
+	info.exists = true;
+	info.directory = S_ISDIR(st.st_mode);
+	info.regular = S_ISREG(st.st_mode);
+	info.size = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+	info.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	info.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return info;
+}
+#endif
+
+} // namespace detail
+
+// Get the size and modification time of a file or directory.
+// Returns an info with [exists] false if it cannot be found.
+FileInfo file_info(const char* name)
+{
+#if defined(_WIN32)
+	WIN32_FILE_ATTRIBUTE_DATA data;
+
+	if (!GetFileAttributesExA(name, GetFileExInfoStandard, &data)) {
+		return {};
+	}
+
+	return detail::file_info(data.dwFileAttributes, data.ftLastWriteTime, data.nFileSizeHigh, data.nFileSizeLow);
+#else
+	struct stat st;
+
+	if (stat(name, &st) != 0) {
+		return {};
+	}
+
+	return detail::file_info(st);
+#endif
+}
+
+// Get the size and modification time of an open file, from the same source and with the same precision as file_info(name).
+FileInfo file_info(FILE* f)
+{
+#if defined(_WIN32)
+	BY_HANDLE_FILE_INFORMATION data;
+	HANDLE handle = (HANDLE)_get_osfhandle(_fileno(f));
+
+	if (handle == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(handle, &data)) {
+		return {};
+	}
+
+	return detail::file_info(data.dwFileAttributes, data.ftLastWriteTime, data.nFileSizeHigh, data.nFileSizeLow);
+#else
+	struct stat st;
+
+	if (fstat(fileno(f), &st) != 0) {
+		return {};
+	}
+
+	return detail::file_info(st);
+#endif
+}
+
+// Check if a file or directory exists, without opening it.
+bool exists(const char* filename)
+{
+#if defined(_WIN32)
+	return GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES;
+#else
+	return access(filename, F_OK) == 0;
+#endif
+}
+
+// Cache of directory listings for checking the existence of many files, like resolving asset paths.
+// The first probe in a directory lists it once, later probes of files in it are a hash lookup without a system call.
+// Note: The cache does not see files added or removed after their directory was listed, call invalidate() or clear() then.
+// Note: Paths are compared as spelled, "a/b.txt" and "a/./b.txt" list the same directory twice. On Windows names are compared case-insensitively.
+// It is safe to probe from several threads.
+struct DirectoryCache
+{
+	// Check if a file or directory exists, listing its parent directory on the first probe.
+	bool exists(std::string_view path)
+	{
+		size_t slash = path.find_last_of(separators());
+		std::string_view dir = directory(path, slash);
+		std::string name(slash == std::string_view::npos ? path : path.substr(slash + 1));
+
+		// Paths naming a directory with a trailing slash or a dot entry are not in the listing of a parent.
+		if (name.empty() || name == "." || name == "..") {
+			return rw::exists(std::string(path).c_str());
+		}
+
+		fold(name);
+
+		std::string key(dir);
+		std::shared_ptr<const Listing> listing = find(key);
+
+		// Listing outside of the lock lets other threads probe directories that are already cached.
+		if (!listing) {
+			std::shared_ptr<const Listing> listed = list(key);
+			std::lock_guard<std::mutex> lock(mutex);
+			listing = listings.emplace(std::move(key), std::move(listed)).first->second;
+		}
+
+		if (!listing->listed) {
+			return rw::exists(std::string(path).c_str());
+		}
+
+		return listing->names.count(name) != 0;
+	}
+
+	// Forget the listing of directory [dir], for example after files were written into it.
+	void invalidate(std::string_view dir)
+	{
+		// Trailing separators are dropped, except the one of a root.
+		while (!dir.empty() && separators().find(dir.back()) != std::string_view::npos) {
+			std::string_view parent = directory(dir, dir.size() - 1);
+
+			if (parent.size() == dir.size()) {
+				break;
+			}
+
+			dir = parent;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		listings.erase(std::string(dir));
+	}
+
+	// Forget all listings.
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		listings.clear();
+	}
+
+	// Number of directories listed.
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return listings.size();
+	}
+
+private:
+	struct Listing
+	{
+		// False if the directory exists but cannot be listed, then probes fall back to rw::exists.
+		bool listed = true;
+		std::unordered_set<std::string> names;
+	};
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<const Listing>> listings;
+
+	static std::string_view separators()
+	{
+#if defined(_WIN32)
+		return "/\\";
+#else
+		return "/";
+#endif
+	}
+
+	// Get the directory of [path] with its last separator at [slash].
+	// A root keeps its separator, "/" or "C:\", because "" and "C:" are the current directory.
+	static std::string_view directory(std::string_view path, size_t slash)
+	{
+		if (slash == std::string_view::npos) {
+			return {};
+		}
+
+		bool root = (slash == 0);
+
+#if defined(_WIN32)
+		root = root || (slash == 2 && path[1] == ':');
+#endif
+
+		return path.substr(0, (root) ? slash + 1 : slash);
+	}
+
+	static void fold(std::string& name)
+	{
+#if defined(_WIN32)
+		for (char& c : name) {
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+		}
+#else
+		(void)name;
+#endif
+	}
+
+	std::shared_ptr<const Listing> find(const std::string& dir) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = listings.find(dir);
+		return (it == listings.end()) ? nullptr : it->second;
+	}
+
+	// A directory that does not exist is an empty listing, all probes in it are false.
+	static std::shared_ptr<const Listing> list(const std::string& dir)
+	{
+		auto listing = std::make_shared<Listing>();
+		detail::IOScope io(IOOp::read);
+
+#if defined(_WIN32)
+		WIN32_FIND_DATAA data;
+		std::string pattern = (dir.empty()) ? std::string(".") : dir;
+
+		if (separators().find(pattern.back()) == std::string_view::npos)
+			pattern += '\\';
+
+		pattern += '*';
+
+		HANDLE find = FindFirstFileExA(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+
+		if (find == INVALID_HANDLE_VALUE) {
+			DWORD error = GetLastError();
+			listing->listed = (error == ERROR_PATH_NOT_FOUND || error == ERROR_FILE_NOT_FOUND || error == ERROR_DIRECTORY);
+			return listing;
+		}
+
+		do {
+			std::string name(data.cFileName);
+			fold(name);
+			listing->names.insert(std::move(name));
+		} while (FindNextFileA(find, &data));
+
+		FindClose(find);
+#else
+		DIR* d = opendir(dir.empty() ? "." : dir.c_str());
+
+		if (!d) {
+			listing->listed = (errno == ENOENT || errno == ENOTDIR);
+			return listing;
+		}
+
+		while (dirent* entry = readdir(d)) {
+			listing->names.insert(entry->d_name);
+		}
+
+		closedir(d);
+#endif
+
+		io.done(listing->names.size());
+		return listing;
+	}
+};
+
+namespace detail
+{
+
+// Move a C file stream to a 64-bit offset, fseek takes a long, which is 32-bit on Windows.
+bool seek_file(FILE* f, uint64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+} // namespace detail
+
+// Pass as [readsize] to read a file to its end.
+constexpr size_t whole_file = (size_t)-1;
+
+// Read file as a string and return it.
+// Parameters:
+//   [name] The name of the file.
+//   [openmode_binary] If true, open file in binary mode, otherwise text mode.
+//   [start] The starting position in the file to read from.
+//   [readsize] If whole_file (or -1), read whole file from [start] (Note: be careful when trying to read very large files, reading them as a whole is not recommended, see readfile_chunks()).
+// Returns: The bytes read, shorter than [readsize] if the file ends first.
+std::string readfile(
+	const char* name,
+	bool openmode_binary = 0,
+	uint64_t start = 0,
+	size_t readsize = whole_file
+) {
+	detail::IOScope io(IOOp::read);
+	std::string str;
+	FILE* f = fopen(name, ((openmode_binary) ? "rb" : "r"));
+
+	if (!f) {
+		return str;
+	}
+
+	if (readsize == whole_file) {
+		uint64_t size = file_info(f).size;
+		uint64_t left = (size > start) ? size - start : 0;
+
+		// The rest of the file does not fit into memory on a 32-bit target.
+		if (left >= (uint64_t)whole_file) {
+			fclose(f);
+			return str;
+		}
+
+		readsize = (size_t)left;
+	}
+
+	if (start && !detail::seek_file(f, start)) {
+		fclose(f);
+		return str;
+	}
+
+	str.resize(readsize);
+
+	// Reads are split into pieces, some C runtimes fail a single fread of several gigabytes.
+	// Text mode translation can also read fewer bytes than the file size.
+	constexpr size_t piece = (size_t)1 << 30;
+	size_t done = 0;
+
+	while (done < str.size()) {
+		size_t want = std::min(str.size() - done, piece);
+		size_t got = fread(str.data() + done, 1, want, f);
+
+		done += got;
+
+		if (got < want) {
+			break;
+		}
+	}
+
+	str.resize(done);
+	io.done(done);
+	fclose(f);
+	return str;
+}
+
+// File handle for reads and writes at arbitrary offsets, without moving a file pointer or reopening the file.
+// Several buffers can be written or read in one call (scatter/gather I/O).
+struct File
+{
+	enum Flags : unsigned
+	{
+		readable = 1,
+		writable = 2,
+		create = 4, // Create the file if it does not exist.
+		truncate = 8,
+		// Bypass the operating system file cache (O_DIRECT, F_NOCACHE or FILE_FLAG_NO_BUFFERING).
+		// Note: Buffer addresses, sizes and offsets usually have to be multiples of the device block size.
+		unbuffered = 16
+	};
+
+	File() = default;
+	File(const char* name, unsigned flags = readable) { open(name, flags); }
+	~File() { close(); }
+
+	File(const File&) = delete;
+	File& operator=(const File&) = delete;
+
+	File(File&& other) noexcept : handle(other.handle) { other.handle = invalid(); }
+
+	File& operator=(File&& other) noexcept
+	{
+		if (this != &other) {
+			close();
+			std::swap(handle, other.handle);
+		}
+		return *this;
+	}
+
+	// Check if the file is open.
+	operator bool() const { return handle != invalid(); }
+
+	// Open a file with a combination of [Flags], closing the previous one.
+	// Returns false if the file cannot be opened.
+	bool open(const char* name, unsigned flags = readable)
+	{
+		close();
+
+		detail::IOScope io(IOOp::open);
+
+#if defined(_WIN32)
+		DWORD access = ((flags & readable) ? GENERIC_READ : 0) | ((flags & writable) ? GENERIC_WRITE : 0);
+		DWORD disposition = (flags & create) ? ((flags & truncate) ? CREATE_ALWAYS : OPEN_ALWAYS) : ((flags & truncate) ? TRUNCATE_EXISTING : OPEN_EXISTING);
+		DWORD attributes = (flags & unbuffered) ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+
+		handle = CreateFileA(name, access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition, attributes, nullptr);
+#else
+		int oflags = ((flags & readable) && (flags & writable)) ? O_RDWR : ((flags & writable) ? O_WRONLY : O_RDONLY);
+
+		if (flags & create)
+			oflags |= O_CREAT;
+
+		if (flags & truncate)
+			oflags |= O_TRUNC;
+
+#if defined(O_DIRECT)
+		if (flags & unbuffered)
+			oflags |= O_DIRECT;
+#endif
+
+		handle = ::open(name, oflags, 0644);
+
+#if defined(F_NOCACHE)
+		if ((flags & unbuffered) && handle >= 0)
+			fcntl(handle, F_NOCACHE, 1);
+#endif
+#endif
+
+		return handle != invalid();
+	}
+
+	// Close the file.
+	void close()
+	{
+		if (handle != invalid()) {
+#if defined(_WIN32)
+			CloseHandle(handle);
+#else
+			::close(handle);
+#endif
+		}
+
+		handle = invalid();
+	}
+
+	// Get the size, modification time and type of the open file, like rw::file_info().
+	// Returns an info with [exists] false if it is not open.
+	FileInfo info() const
+	{
+#if defined(_WIN32)
+		BY_HANDLE_FILE_INFORMATION data;
+
+		if (!GetFileInformationByHandle(handle, &data)) {
+			return {};
+		}
+
+		return detail::file_info(data.dwFileAttributes, data.ftLastWriteTime, data.nFileSizeHigh, data.nFileSizeLow);
+#else
+		struct stat st;
+
+		if (fstat(handle, &st) != 0) {
+			return {};
+		}
+
+		return detail::file_info(st);
+#endif
+	}
+
+	// Get the size of the file, or 0 if it is not open.
+	uint64_t size() const
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER file_size;
+		return (GetFileSizeEx(handle, &file_size)) ? (uint64_t)file_size.QuadPart : 0;
+#else
+		struct stat st;
+		return (fstat(handle, &st) == 0) ? (uint64_t)st.st_size : 0;
+#endif
+	}
+
+	// Read up to [readsize] bytes at [offset] into destination, returns the number of bytes read.
+	// If a read fails, the error code (errno, or GetLastError() on Windows) is stored in [error], and the bytes read before it are returned.
+	size_t pread(void* destination, size_t readsize, uint64_t offset, int* error = nullptr) const
+	{
+		detail::IOScope io(IOOp::read);
+		char* dest = (char*)destination;
+		size_t done = 0;
+
+		while (done < readsize) {
+#if defined(_WIN32)
+			OVERLAPPED at = {};
+			DWORD got = 0;
+
+			at.Offset = (DWORD)(offset + done);
+			at.OffsetHigh = (DWORD)((offset + done) >> 32);
+
+			if (!ReadFile(handle, dest + done, (DWORD)std::min<size_t>(readsize - done, 1u << 30), &got, &at)) {
+				if (error && GetLastError() != ERROR_HANDLE_EOF)
+					*error = (int)GetLastError();
+				break;
+			}
+
+			if (got == 0) {
+				break;
+			}
+#else
+			ssize_t got = ::pread(handle, dest + done, readsize - done, (off_t)(offset + done));
+
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (got <= 0) {
+				if (got < 0 && error)
+					*error = errno;
+				break;
+			}
+#endif
+
+			done += (size_t)got;
+		}
+
+		io.done(done);
+		return done;
+	}
+
+	// Write [writesize] bytes from source at [offset], returns the number of bytes written.
+	// The file grows if needed. Errors are stored in [error] like in pread().
+	size_t pwrite(const void* source, size_t writesize, uint64_t offset, int* error = nullptr)
+	{
+		detail::IOScope io(IOOp::write);
+		const char* src = (const char*)source;
+		size_t done = 0;
+
+		while (done < writesize) {
+#if defined(_WIN32)
+			OVERLAPPED at = {};
+			DWORD put = 0;
+
+			at.Offset = (DWORD)(offset + done);
+			at.OffsetHigh = (DWORD)((offset + done) >> 32);
+
+			if (!WriteFile(handle, src + done, (DWORD)std::min<size_t>(writesize - done, 1u << 30), &put, &at)) {
+				if (error)
+					*error = (int)GetLastError();
+				break;
+			}
+
+			if (put == 0) {
+				break;
+			}
+#else
+			ssize_t put = ::pwrite(handle, src + done, writesize - done, (off_t)(offset + done));
+
+			if (put < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (put <= 0) {
+				if (put < 0 && error)
+					*error = errno;
+				break;
+			}
+#endif
+
+			done += (size_t)put;
+		}
+
+		io.done(done);
+		return done;
+	}
+
+	// Write [count] buffers back to back starting at [offset], returns the number of bytes written.
+	// <Buffer> is any contiguous byte container with data() and size(), such as WriteStream or std::string.
+	template<typename Buffer>
+	size_t writev(const Buffer* buffers, size_t count, uint64_t offset)
+	{
+#if defined(RW_HAS_PREADV)
+		detail::IOScope io(IOOp::write);
+		size_t done = vectored(buffers, count, offset, [this](const iovec* iov, int n, uint64_t at) {
+			return ::pwritev(handle, iov, n, (off_t)at);
+		});
+
+		io.done(done);
+		return done;
+#else
+		size_t done = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			size_t put = pwrite(buffers[i].data(), buffers[i].size(), offset + done);
+
+			done += put;
+
+			if (put < buffers[i].size()) {
+				break;
+			}
+		}
+
+		return done;
+#endif
+	}
+
+	// Read into [count] buffers back to back starting at [offset], filling the current size of each buffer.
+	// Returns the number of bytes read.
+	template<typename Buffer>
+	size_t readv(Buffer* buffers, size_t count, uint64_t offset) const
+	{
+#if defined(RW_HAS_PREADV)
+		detail::IOScope io(IOOp::read);
+		size_t done = vectored(buffers, count, offset, [this](const iovec* iov, int n, uint64_t at) {
+			return ::preadv(handle, iov, n, (off_t)at);
+		});
+
+		io.done(done);
+		return done;
+#else
+		size_t done = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			size_t got = pread(buffers[i].data(), buffers[i].size(), offset + done);
+
+			done += got;
+
+			if (got < buffers[i].size()) {
+				break;
+			}
+		}
+
+		return done;
+#endif
+	}
+
+	// Flush the written data to the storage device.
+	bool sync()
+	{
+		detail::IOScope io(IOOp::sync);
+
+#if defined(_WIN32)
+		return FlushFileBuffers(handle) != 0;
+#elif defined(__APPLE__)
+		return fsync(handle) == 0;
+#else
+		return fdatasync(handle) == 0;
+#endif
+	}
+
+#if defined(_WIN32)
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	static HANDLE invalid() { return INVALID_HANDLE_VALUE; }
+#else
+	int handle = -1;
+	static int invalid() { return -1; }
+#endif
+
+private:
+#if defined(RW_HAS_PREADV)
+	// Run [io](iovec, count, offset) over the buffers in batches of IOV_MAX, resuming after short transfers.
+	template<typename Buffer, typename IO>
+	static size_t vectored(Buffer* buffers, size_t count, uint64_t offset, IO&& io)
+	{
+		std::vector<iovec> iov(count);
+
+		for (size_t i = 0; i < count; i++)
+			iov[i] = { (void*)buffers[i].data(), buffers[i].size() };
+
+		size_t done = 0;
+		size_t first = 0;
+
+		while (first < count) {
+			int n = (int)std::min<size_t>(count - first, IOV_MAX);
+			ssize_t moved = io(iov.data() + first, n, offset + done);
+
+			if (moved < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (moved <= 0) {
+				break;
+			}
+
+			done += (size_t)moved;
+
+			// Skip the buffers that were transferred completely, and the transferred part of a partial one.
+			size_t left = (size_t)moved;
+
+			while (first < count && left >= iov[first].iov_len) {
+				left -= iov[first].iov_len;
+				first++;
+			}
+
+			if (first < count && left) {
+				iov[first].iov_base = (char*)iov[first].iov_base + left;
+				iov[first].iov_len -= left;
+			}
+		}
+
+		return done;
+	}
+#endif
+};
+
+// Write data to file.
+// Parameters:
+//   [start] The starting position in the file to write to:
+//   - If -1, write at the end of file.
+//   - Otherwise, write from that position.
+//   [overwrite] If true, truncate the file, otherwise open the file and overwrite data.
+void writefile(
+	const char* name,
+	void* data,
+	size_t readsize,
+	int64_t start = 0,
+	bool overwrite = true
+) {
+	File f(name, File::writable | File::create | ((overwrite) ? File::truncate : 0u));
+
+	if (f) {
+		f.pwrite(data, readsize, (start == -1) ? f.size() : (uint64_t)start);
+	}
+}
+
+// Read a file in chunks, without holding all of it in memory, for files larger than the address space or than is sensible to allocate at once.
+// Parameters:
+//   [on_chunk] Called with each chunk and its offset in the file, return false to stop reading.
+//   [chunk_size] The size of the chunks, only the last one is shorter.
+//   [start] The starting position in the file to read from.
+//   [readsize] The number of bytes to read, UINT64_MAX reads to the end of the file.
+// Returns: False if the file cannot be opened or a read fails before [readsize] bytes or the end of the file, true if it was read or [on_chunk] stopped.
+// Note: The chunk data is only valid during the call, the same buffer is reused for all chunks.
+bool readfile_chunks(
+	const char* name,
+	const std::function<bool(const char* data, size_t size, uint64_t offset)>& on_chunk,
+	size_t chunk_size = 1 << 20,
+	uint64_t start = 0,
+	uint64_t readsize = UINT64_MAX
+) {
+	File f(name, File::readable);
+
+	if (!f) {
+		return false;
+	}
+
+	uint64_t size = f.size();
+	uint64_t end = (size > start) ? start + std::min(readsize, size - start) : start;
+
+	chunk_size = std::max<size_t>(1, (size_t)std::min<uint64_t>(chunk_size, end - start));
+	std::unique_ptr<char[]> buffer(new char[chunk_size]);
+
+	for (uint64_t offset = start; offset < end;) {
+		size_t want = (size_t)std::min<uint64_t>(chunk_size, end - offset);
+		size_t got = f.pread(buffer.get(), want, offset);
+
+		if (got && !on_chunk(buffer.get(), got, offset)) {
+			return true;
+		}
+
+		if (got < want) {
+			return false;
+		}
+
+		offset += got;
+	}
+
+	return true;
+}
+
+namespace detail
+{
+
+// Get the directory of a file path, "." if it has none.
+std::string parent_dir(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+
+	if (slash == std::string::npos) {
+		return ".";
+	}
+
+	return (slash == 0) ? path.substr(0, 1) : path.substr(0, slash);
+}
+
+// Flush a directory entry change (a created or renamed file) to the storage device.
+// Windows writes renames through with MOVEFILE_WRITE_THROUGH instead, so this does nothing there.
+bool sync_dir(const std::string& dir)
+{
+#if defined(_WIN32)
+	(void)dir;
+	return true;
+#else
+	IOScope io(IOOp::sync);
+	int fd = ::open(dir.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	bool ok = (fsync(fd) == 0);
+
+	::close(fd);
+	return ok;
+#endif
+}
+
+// Rename a file, replacing the destination if it exists.
+bool replace_file(const char* from, const char* to)
+{
+#if defined(_WIN32)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+} // namespace detail
+
+// Group of atomic file replacements that share a single batched sync.
+// Each write goes to a temporary file next to its target. commit() flushes all temporary files, renames them over their targets,
+// and flushes each directory once. Each target is either left as it was or completely replaced, even if the program or the system crashes.
+// The group as a whole is not atomic: the renames happen one after another, so a crash or a failure during commit() can leave
+// some targets replaced and others not.
+// Note: Temporary files of a transaction that is not committed are removed by rollback() or the destructor.
+// Note: Replaced files get the permissions of newly created files, not those of the files they replace.
+struct FileTransaction
+{
+	FileTransaction() = default;
+	~FileTransaction() { rollback(); }
+
+	FileTransaction(const FileTransaction&) = delete;
+	FileTransaction& operator=(const FileTransaction&) = delete;
+
+	// Write the new contents of file [name], the file itself is only replaced by commit().
+	// Returns false if the temporary file cannot be written.
+	bool write(const char* name, const void* data, size_t size)
+	{
+		static std::atomic<unsigned> counter{ 0 };
+
+#if defined(_WIN32)
+		unsigned long pid = GetCurrentProcessId();
+#else
+		unsigned long pid = (unsigned long)getpid();
+#endif
+
+		Pending p;
+
+		p.target = name;
+		p.temp = p.target + ".tmp." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1));
+		p.file.open(p.temp.c_str(), File::writable | File::create | File::truncate);
+
+		if (!p.file || p.file.pwrite(data, size, 0) != size) {
+			p.file.close();
+			remove(p.temp.c_str());
+			return false;
+		}
+
+		pending.push_back(std::move(p));
+		return true;
+	}
+
+	// Make all writes durable and replace their files.
+	// Returns false if a file cannot be flushed or replaced. Files that were replaced before the failure stay replaced.
+	bool commit()
+	{
+#if defined(__linux__)
+		// Start the writeback of all files first, so the flushes below mostly wait on I/O that is already running side by side.
+		for (Pending& p : pending)
+			sync_file_range(p.file.handle, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+
+		bool ok = true;
+
+		for (Pending& p : pending) {
+			if (ok && !p.file.sync())
+				ok = false;
+
+			p.file.close();
+		}
+
+		std::vector<std::string> dirs;
+
+		for (size_t i = 0; ok && i < pending.size(); i++) {
+			if (!detail::replace_file(pending[i].temp.c_str(), pending[i].target.c_str())) {
+				ok = false;
+				break;
+			}
+
+			pending[i].temp.clear();
+			dirs.push_back(detail::parent_dir(pending[i].target));
+		}
+
+		std::sort(dirs.begin(), dirs.end());
+		dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+
+		for (const std::string& dir : dirs) {
+			if (!detail::sync_dir(dir))
+				ok = false;
+		}
+
+		rollback();
+		return ok;
+	}
+
+	// Discard the writes that were not committed.
+	void rollback()
+	{
+		for (Pending& p : pending) {
+			p.file.close();
+
+			if (!p.temp.empty())
+				remove(p.temp.c_str());
+		}
+
+		pending.clear();
+	}
+
+private:
+	struct Pending
+	{
+		std::string target;
+		std::string temp; // Empty once renamed.
+		File file;
+	};
+
+	std::vector<Pending> pending;
+};
+
+// Replace a file with new contents atomically and durably: the contents go to a temporary file, which is flushed to the storage
+// device and renamed over the file, then the directory is flushed. After a crash the file has either its old or its new contents.
+// Returns false if the file could not be replaced, it then keeps its old contents.
+bool writefile_atomic(
+	const char* name,
+	const void* data,
+	size_t size
+) {
+	FileTransaction transaction;
+	return transaction.write(name, data, size) && transaction.commit();
+}
+
+// Asynchronous file I/O engine: reads and writes are queued and complete in the background, results are delivered through futures.
+// Many requests can be submitted as one batch, to keep lots of reads in flight on fast storage.
+// On Linux the requests go through io_uring (one system call per batch), elsewhere, or if io_uring is not available, they run on a pool of threads.
+// Note: All buffers and files must stay alive until their request has completed.
+struct AsyncIO
+{
+	struct Request
+	{
+		File* file;
+		void* data; // The destination of a read, or the source of a write.
+		size_t size;
+		uint64_t offset;
+		bool write = false;
+	};
+
+	// Parameters:
+	//   [queue_depth] The maximum number of requests in flight through io_uring.
+	//   [threads] The number of threads when io_uring is not used, if 0 use std::thread::hardware_concurrency().
+	AsyncIO(unsigned queue_depth = 256, unsigned threads = 0)
+	{
+#if defined(RW_IO_URING)
+		if (ring.setup(std::max(queue_depth, 1u))) {
+			reaper = std::thread([this]() { reap(); });
+			return;
+		}
+#else
+		(void)queue_depth;
+#endif
+
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (unsigned i = 0; i < threads; i++)
+			workers.emplace_back([this]() { work(); });
+	}
+
+	AsyncIO(const AsyncIO&) = delete;
+	AsyncIO& operator=(const AsyncIO&) = delete;
+
+	// Wait for all requests to complete.
+	~AsyncIO()
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [this]() { return inflight == 0; });
+			stop = true;
+		}
+
+		changed.notify_all();
+
+		for (std::thread& worker : workers)
+			worker.join();
+
+#if defined(RW_IO_URING)
+		if (reaper.joinable()) {
+			ring.submit_stop();
+			reaper.join();
+			ring.close();
+		}
+#endif
+	}
+
+	// Check if requests go through io_uring.
+	bool uses_io_uring() const
+	{
+#if defined(RW_IO_URING)
+		return ring.fd >= 0;
+#else
+		return false;
+#endif
+	}
+
+	// Queue a read of up to [size] bytes at [offset] into [dest], the future holds the number of bytes read.
+	// A request that fails before transferring anything holds a std::system_error instead, one that fails part way holds the bytes transferred until then.
+	std::future<size_t> read(File& file, void* dest, size_t size, uint64_t offset)
+	{
+		return std::move(submit({ { &file, dest, size, offset, false } })[0]);
+	}
+
+	// Queue a write of [size] bytes from [src] at [offset], the future holds the number of bytes written.
+	std::future<size_t> write(File& file, const void* src, size_t size, uint64_t offset)
+	{
+		return std::move(submit({ { &file, (void*)src, size, offset, true } })[0]);
+	}
+
+	// Queue a batch of requests, the futures hold the number of bytes transferred by each request.
+	std::vector<std::future<size_t>> submit(const std::vector<Request>& batch)
+	{
+		std::vector<std::future<size_t>> results;
+		std::vector<Op*> ops;
+
+		results.reserve(batch.size());
+		ops.reserve(batch.size());
+
+		for (const Request& req : batch) {
+			auto done = std::make_shared<std::promise<size_t>>();
+
+			results.push_back(done->get_future());
+			ops.push_back(new Op{ req, [done](size_t transferred, int error) { finish(*done, transferred, error); } });
+		}
+
+		enqueue(ops.data(), ops.size());
+		return results;
+	}
+
+	// Read a whole file in the background, see rw::readfile().
+	// The future holds an empty string if the file cannot be opened, or a std::system_error if it cannot be read.
+	std::future<std::string> readfile(const char* name)
+	{
+		struct Load
+		{
+			File file;
+			std::string str;
+			std::promise<std::string> done;
+		};
+
+		auto load = std::make_shared<Load>();
+		std::future<std::string> result = load->done.get_future();
+
+		if (!load->file.open(name, File::readable)) {
+			load->done.set_value({});
+			return result;
+		}
+
+		load->str.resize((size_t)load->file.size());
+
+		Op* op = new Op{ { &load->file, load->str.data(), load->str.size(), 0, false }, [load](size_t transferred, int error) {
+			if (error && !transferred) {
+				load->done.set_exception(std::make_exception_ptr(std::system_error(error_code(error))));
+				return;
+			}
+
+			load->str.resize(transferred);
+			load->done.set_value(std::move(load->str));
+		} };
+
+		enqueue(&op, 1);
+		return result;
+	}
+
+	// Write a whole file in the background, truncating it, see rw::writefile().
+	// The future holds the number of bytes written.
+	// Note: [data] must stay alive until the write has completed.
+	std::future<size_t> writefile(const char* name, const void* data, size_t size)
+	{
+		auto file = std::make_shared<File>(name, File::writable | File::create | File::truncate);
+		auto done = std::make_shared<std::promise<size_t>>();
+		std::future<size_t> result = done->get_future();
+
+		if (!*file) {
+			done->set_value(0);
+			return result;
+		}
+
+		Op* op = new Op{ { file.get(), (void*)data, size, 0, true }, [file, done](size_t transferred, int error) {
+			finish(*done, transferred, error);
+		} };
+
+		enqueue(&op, 1);
+		return result;
+	}
+
+private:
+	struct Op
+	{
+		Request req; // The part of the request that is left, moved forward after a short transfer.
+		std::function<void(size_t transferred, int error)> done;
+		size_t transferred = 0;
+	};
+
+	std::mutex lock;
+	std::condition_variable changed;
+	size_t inflight = 0;
+	bool stop = false;
+
+	std::deque<Op*> queue;
+	std::vector<std::thread> workers;
+
+	void enqueue(Op** ops, size_t count)
+	{
+#if defined(RW_IO_URING)
+		if (ring.fd >= 0) {
+			std::unique_lock<std::mutex> guard(lock);
+
+			for (size_t i = 0; i < count;) {
+				changed.wait(guard, [this]() { return inflight < ring.entries; });
+
+				unsigned queued = 0;
+
+				for (; i < count && inflight < ring.entries; i++, inflight++, queued++)
+					ring.push(ops[i]->req, (uint64_t)(uintptr_t)ops[i]);
+
+				inflight -= submit_queued(ops + i - queued, queued);
+			}
+
+			changed.notify_all();
+			return;
+		}
+#endif
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			queue.insert(queue.end(), ops, ops + count);
+			inflight += count;
+		}
+
+		changed.notify_all();
+	}
+
+	static std::error_code error_code(int error)
+	{
+#if defined(_WIN32)
+		return std::error_code(error, std::system_category());
+#else
+		return std::error_code(error, std::generic_category());
+#endif
+	}
+
+	static void finish(std::promise<size_t>& done, size_t transferred, int error)
+	{
+		if (error && !transferred) {
+			done.set_exception(std::make_exception_ptr(std::system_error(error_code(error))));
+		}
+		else {
+			done.set_value(transferred);
+		}
+	}
+
+	static void complete(Op* op, int error)
+	{
+		op->done(op->transferred, error);
+		delete op;
+	}
+
+	void work()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		for (;;) {
+			changed.wait(guard, [this]() { return stop || !queue.empty(); });
+
+			if (queue.empty()) {
+				return;
+			}
+
+			Op* op = queue.front();
+			queue.pop_front();
+			guard.unlock();
+
+			const Request& req = op->req;
+			int error = 0;
+
+			op->transferred = (req.write) ? req.file->pwrite(req.data, req.size, req.offset, &error) : req.file->pread(req.data, req.size, req.offset, &error);
+			complete(op, error);
+
+			guard.lock();
+			inflight--;
+
+			if (inflight == 0)
+				changed.notify_all();
+		}
+	}
+
+#if defined(RW_IO_URING)
+	// Minimal io_uring over the raw system calls.
+	struct Ring
+	{
+		int fd = -1;
+		unsigned entries = 0;
+
+		void* sq_ptr = nullptr;
+		void* cq_ptr = nullptr;
+		size_t sq_size = 0;
+		size_t cq_size = 0;
+		io_uring_sqe* sqes = nullptr;
+		size_t sqes_size = 0;
+
+		unsigned* sq_tail = nullptr;
+		unsigned* sq_mask = nullptr;
+		unsigned* sq_array = nullptr;
+		unsigned* cq_head = nullptr;
+		unsigned* cq_tail = nullptr;
+		unsigned* cq_mask = nullptr;
+		io_uring_cqe* cqes = nullptr;
+
+		bool setup(unsigned depth)
+		{
+			io_uring_params params = {};
+
+			fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+
+			if (fd < 0) {
+				return false;
+			}
+
+			if (!probe()) {
+				close();
+				return false;
+			}
+
+			entries = params.sq_entries;
+			sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				sq_size = cq_size = std::max(sq_size, cq_size);
+
+			sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			void* sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+			if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED) {
+				sqes = (sqes_ptr == MAP_FAILED) ? nullptr : (io_uring_sqe*)sqes_ptr;
+				sq_ptr = (sq_ptr == MAP_FAILED) ? nullptr : sq_ptr;
+				cq_ptr = (cq_ptr == MAP_FAILED) ? nullptr : cq_ptr;
+				close();
+				return false;
+			}
+
+			sqes = (io_uring_sqe*)sqes_ptr;
+			sq_tail = (unsigned*)((char*)sq_ptr + params.sq_off.tail);
+			sq_mask = (unsigned*)((char*)sq_ptr + params.sq_off.ring_mask);
+			sq_array = (unsigned*)((char*)sq_ptr + params.sq_off.array);
+			cq_head = (unsigned*)((char*)cq_ptr + params.cq_off.head);
+			cq_tail = (unsigned*)((char*)cq_ptr + params.cq_off.tail);
+			cq_mask = (unsigned*)((char*)cq_ptr + params.cq_off.ring_mask);
+			cqes = (io_uring_cqe*)((char*)cq_ptr + params.cq_off.cqes);
+			return true;
+		}
+
+		// Check that the kernel has the read and write operations, they are newer (Linux 5.6) than io_uring itself.
+		bool probe()
+		{
+			const unsigned count = 64;
+			std::vector<char> storage(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+			io_uring_probe* ops = (io_uring_probe*)storage.data();
+
+			if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, ops, count) < 0) {
+				return false;
+			}
+
+			auto supported = [&](unsigned op) { return op <= ops->last_op && op < count && (ops->ops[op].flags & IO_URING_OP_SUPPORTED); };
+			return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+		}
+
+		void close()
+		{
+			if (sqes)
+				munmap(sqes, sqes_size);
+
+			if (cq_ptr && cq_ptr != sq_ptr)
+				munmap(cq_ptr, cq_size);
+
+			if (sq_ptr)
+				munmap(sq_ptr, sq_size);
+
+			if (fd >= 0)
+				::close(fd);
+
+			fd = -1;
+			sq_ptr = cq_ptr = nullptr;
+			sqes = nullptr;
+		}
+
+		// Put a submission in the queue, the caller makes sure there is room for it.
+		void push(const Request& req, uint64_t user_data, uint8_t opcode = 0)
+		{
+			unsigned tail = *sq_tail;
+			unsigned index = tail & *sq_mask;
+			io_uring_sqe* sqe = &sqes[index];
+
+			memset(sqe, 0, sizeof(*sqe));
+
+			if (user_data) {
+				sqe->opcode = (req.write) ? IORING_OP_WRITE : IORING_OP_READ;
+				sqe->fd = req.file->handle;
+				sqe->addr = (uint64_t)(uintptr_t)req.data;
+				sqe->len = (uint32_t)std::min<size_t>(req.size, 1u << 30);
+				sqe->off = req.offset;
+			}
+			else {
+				sqe->opcode = opcode;
+			}
+
+			sqe->user_data = user_data;
+			sq_array[index] = index;
+			__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		// Submit [count] queued submissions, returns the number submitted.
+		// If the kernel refuses them, the errno is stored in [error] and the rest stays queued, see unpush().
+		unsigned enter(unsigned count, int* error = nullptr)
+		{
+			unsigned done = 0;
+
+			while (done < count) {
+				int submitted = (int)syscall(__NR_io_uring_enter, fd, count - done, 0, 0, nullptr, 0);
+
+				if (submitted > 0) {
+					done += (unsigned)submitted;
+				}
+				else if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+					if (error)
+						*error = errno;
+					break;
+				}
+			}
+
+			return done;
+		}
+
+		// Take back the last [count] queued submissions that were not submitted.
+		void unpush(unsigned count)
+		{
+			__atomic_store_n(sq_tail, *sq_tail - count, __ATOMIC_RELEASE);
+		}
+
+		// Submit the no-op that stops the reaper thread.
+		void submit_stop()
+		{
+			push({}, 0, IORING_OP_NOP);
+			enter(1);
+		}
+	};
+
+	Ring ring;
+	std::thread reaper;
+
+	// Submit the [count] ops last pushed to the ring, the ones the kernel refuses are completed with its error.
+	// Returns the number of ops completed that way. The caller holds [lock].
+	size_t submit_queued(Op** ops, unsigned count)
+	{
+		int error = 0;
+		unsigned submitted = ring.enter(count, &error);
+
+		if (submitted == count) {
+			return 0;
+		}
+
+		ring.unpush(count - submitted);
+
+		for (unsigned i = submitted; i < count; i++)
+			complete(ops[i], error);
+
+		return count - submitted;
+	}
+
+	void reap()
+	{
+		std::vector<Op*> again;
+
+		for (bool stopping = false; !stopping;) {
+			if (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				// The requests in flight still complete into the ring, so keep collecting them without waiting in the kernel.
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			unsigned head = *ring.cq_head;
+			unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+			size_t completed = 0;
+
+			for (; head != tail; head++) {
+				const io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+
+				if (!cqe.user_data) {
+					stopping = true;
+					continue;
+				}
+
+				Op* op = (Op*)(uintptr_t)cqe.user_data;
+				Request& req = op->req;
+
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+					again.push_back(op);
+				}
+				else if (cqe.res < 0) {
+					complete(op, -cqe.res);
+					completed++;
+				}
+				else if (cqe.res > 0 && (size_t)cqe.res < req.size) {
+					// Transfers are capped at 1 GiB and can be short, the rest is submitted again like File::pread() loops.
+					op->transferred += (size_t)cqe.res;
+					req.data = (char*)req.data + cqe.res;
+					req.size -= (size_t)cqe.res;
+					req.offset += (uint64_t)cqe.res;
+					again.push_back(op);
+				}
+				else {
+					op->transferred += (size_t)cqe.res;
+					complete(op, 0);
+					completed++;
+				}
+			}
+
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+			if (!again.empty() || completed) {
+				{
+					std::lock_guard<std::mutex> guard(lock);
+
+					// Every op in flight has at most one submission queued, so there is room for the ones submitted again.
+					for (Op* op : again)
+						ring.push(op->req, (uint64_t)(uintptr_t)op);
+
+					completed += submit_queued(again.data(), (unsigned)again.size());
+					inflight -= completed;
+				}
+
+				again.clear();
+				changed.notify_all();
+			}
+		}
+	}
+#endif
+};
+
+// Write log message to an output text file.
+// Parameters:
+//   [overwrite] If true, overwrite the file, otherwise append data.
+// Note:
+// This function is useful for writing error logs into a text file. When terminate() or abort() is called, data written to existing file streams may not be written to files. This is a problem because when a fatal error occurs in an application, either function is called. No error information is written, so there's no way to diagnose fatal errors!
+void log(
+	const char* name,
+	const char* message,
+	bool overwrite = false
+) {
+	FILE* f = fopen(name, ((overwrite) ? "w" : "a"));
+
+	if (f) {
+		fputs(message, f);
+		fclose(f);
+	}
+}
+
+namespace detail
+{
+
+// Write all of [size] bytes to a file descriptor, returns the number of bytes written before an error.
+// Not seen by the instrumentation, whose counters and hook are not safe to use from a signal handler.
+size_t write_fd_raw(int fd, const char* data, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size) {
+#if defined(_WIN32)
+		int written = _write(fd, data + done, (unsigned)std::min<size_t>(size - done, 1u << 30));
+#else
+		ssize_t written = ::write(fd, data + done, size - done);
+
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+#endif
+
+		if (written <= 0) {
+			break;
+		}
+
+		done += (size_t)written;
+	}
+
+	return done;
+}
+
+// Write all of [size] bytes to a file descriptor, returns false on error.
+bool write_fd(int fd, const char* data, size_t size)
+{
+	IOScope io(IOOp::write);
+	size_t written = write_fd_raw(fd, data, size);
+
+	io.done(written);
+	return written == size;
+}
+
+// Flush the data of a file descriptor to the storage device, without instrumentation like write_fd_raw().
+bool sync_fd_raw(int fd)
+{
+#if defined(_WIN32)
+	return _commit(fd) == 0;
+#elif defined(__APPLE__)
+	return fsync(fd) == 0;
+#else
+	return fdatasync(fd) == 0;
+#endif
+}
+
+// Flush the data of a file descriptor to the storage device.
+bool sync_fd(int fd)
+{
+	IOScope io(IOOp::sync);
+	return sync_fd_raw(fd);
+}
+
+} // namespace detail
+
+// Log file that stays open, with messages collected in a ring buffer and written out in batches by a background thread.
+// Logging a message takes no lock and no system call, unless the buffer is full.
+// Messages that are still buffered are written out by flush(), by the destructor, and also when std::terminate() is called,
+// so fatal errors are still logged like with log() (for up to 16 loggers alive at a time).
+// Call catch_fatal_signals() to also write them out when a fatal signal (SIGABRT, SIGSEGV, ...) is raised.
+struct Logger
+{
+	// Parameters:
+	//   [overwrite] If true, overwrite the file, otherwise append data.
+	//   [capacity] The size of the ring buffer, rounded up to a power of 2. Longer messages are written directly.
+	//   [sync] If true, each written batch is also flushed to the storage device (fdatasync).
+	Logger(
+		const char* name,
+		bool overwrite = false,
+		size_t capacity = 1 << 20,
+		bool sync = false
+	) : sync(sync) {
+#if defined(_WIN32)
+		fd = _open(name, _O_WRONLY | _O_CREAT | _O_TEXT | ((overwrite) ? _O_TRUNC : _O_APPEND), _S_IREAD | _S_IWRITE);
+#else
+		fd = ::open(name, O_WRONLY | O_CREAT | ((overwrite) ? O_TRUNC : O_APPEND), 0644);
+#endif
+
+		size_t cap = 1;
+
+		while (cap < capacity)
+			cap *= 2;
+
+		ring.resize(cap);
+		enroll(this);
+		flusher = std::thread([this]() { run(); });
+	}
+
+	Logger(const Logger&) = delete;
+	Logger& operator=(const Logger&) = delete;
+
+	~Logger()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wake_lock);
+			stop = true;
+		}
+
+		wake.notify_one();
+		flusher.join();
+		enroll(nullptr, this);
+
+		if (fd >= 0) {
+#if defined(_WIN32)
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+	}
+
+	// Check if the log file is open.
+	operator bool() const { return fd >= 0; }
+
+	// Append a message to the log.
+	void log(std::string_view message)
+	{
+		size_t cap = ring.size();
+
+		if (message.size() > cap) {
+			flush();
+			write_out(message.data(), message.size());
+			return;
+		}
+
+		size_t start = reserved.load(std::memory_order_relaxed);
+
+		// Reserve space in the ring, waiting for the flusher if it is full.
+		for (;;) {
+			if (start + message.size() - flushed.load(std::memory_order_acquire) > cap) {
+				wake.notify_one();
+				std::this_thread::yield();
+				start = reserved.load(std::memory_order_relaxed);
+			}
+			else if (reserved.compare_exchange_weak(start, start + message.size(), std::memory_order_relaxed)) {
+				break;
+			}
+		}
+
+		size_t at = start & (cap - 1);
+		size_t first = std::min(message.size(), cap - at);
+
+		memcpy(ring.data() + at, message.data(), first);
+		memcpy(ring.data(), message.data() + first, message.size() - first);
+
+		// Publish messages in the order their space was reserved.
+		while (committed.load(std::memory_order_acquire) != start)
+			std::this_thread::yield();
+
+		committed.store(start + message.size(), std::memory_order_release);
+
+		if (start + message.size() - flushed.load(std::memory_order_relaxed) > cap / 2)
+			wake.notify_one();
+	}
+
+	Logger& operator()(std::string_view message)
+	{
+		log(message);
+		return *this;
+	}
+
+	// Write all messages logged so far to the file.
+	void flush()
+	{
+		while (writing.exchange(true, std::memory_order_acquire))
+			std::this_thread::yield();
+
+		write_pending();
+		writing.store(false, std::memory_order_release);
+	}
+
+	// Write all logged messages of every Logger, called on crashes.
+	// Only uses what is safe to call from a signal handler. A flush that is in progress on another thread is waited for only briefly,
+	// so in the worst case some messages are written twice instead of never.
+	static void flush_all_on_crash()
+	{
+		for (std::atomic<Logger*>& slot : registry()) {
+			Logger* logger = slot.load(std::memory_order_acquire);
+
+			if (!logger) {
+				continue;
+			}
+
+			bool locked = false;
+
+			for (int spins = 0; spins < (1 << 20) && !locked; spins++)
+				locked = !logger->writing.exchange(true, std::memory_order_acquire);
+
+			// The flush that holds the flag may be the one the crash interrupted, so the messages are written anyway,
+			// but the flag is only released by its owner.
+			logger->write_pending(true);
+
+			if (locked)
+				logger->writing.store(false, std::memory_order_release);
+		}
+	}
+
+	// Write out the messages of every Logger when a fatal signal (SIGABRT, SIGSEGV, SIGFPE, SIGILL, SIGBUS) is raised.
+	// The handlers that were installed before are kept, and called after the messages are written.
+	// Signals without a handler of their own are raised again with the default action, which terminates the process.
+	// Note: Install signal handlers of the application before calling this, handlers installed later replace these.
+	static void catch_fatal_signals()
+	{
+		static std::once_flag installed;
+
+		std::call_once(installed, []() {
+			for (size_t i = 0; i < fatal_signals.size(); i++) {
+#if defined(_WIN32)
+				previous_signals()[i] = std::signal(fatal_signals[i], crash_signal);
+#else
+				struct sigaction action = {};
+
+				action.sa_sigaction = crash_signal;
+				action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+				sigemptyset(&action.sa_mask);
+				sigaction(fatal_signals[i], &action, &previous_signals()[i]);
+#endif
+			}
+		});
+	}
+
+private:
+	static constexpr std::chrono::milliseconds flush_interval{ 50 };
+
+	int fd = -1;
+	bool sync;
+	std::vector<char> ring;
+	std::atomic<size_t> reserved{ 0 }; // End of the space reserved by writers.
+	std::atomic<size_t> committed{ 0 }; // End of the messages that are completely in the ring.
+	std::atomic<size_t> flushed{ 0 }; // End of the messages that are written to the file.
+	std::atomic<bool> writing{ false };
+
+	std::thread flusher;
+	std::mutex wake_lock;
+	std::condition_variable wake;
+	bool stop = false;
+
+	// [on_crash] is true when called from a signal handler, the writes are then not instrumented.
+	void write_out(const char* data, size_t size, bool on_crash = false)
+	{
+		if (fd < 0) {
+			return;
+		}
+
+		if (on_crash) {
+			detail::write_fd_raw(fd, data, size);
+		}
+		else {
+			detail::write_fd(fd, data, size);
+		}
+	}
+
+	void write_pending(bool on_crash = false)
+	{
+		size_t from = flushed.load(std::memory_order_relaxed);
+		size_t to = committed.load(std::memory_order_acquire);
+
+		if (from == to) {
+			return;
+		}
+
+		size_t cap = ring.size();
+		size_t at = from & (cap - 1);
+		size_t first = std::min(to - from, cap - at);
+
+		write_out(ring.data() + at, first, on_crash);
+		write_out(ring.data(), to - from - first, on_crash);
+
+		if (sync && fd >= 0) {
+			if (on_crash) {
+				detail::sync_fd_raw(fd);
+			}
+			else {
+				detail::sync_fd(fd);
+			}
+		}
+
+		flushed.store(to, std::memory_order_release);
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(wake_lock);
+
+		while (!stop) {
+			wake.wait_for(lock, flush_interval);
+			lock.unlock();
+			flush();
+			lock.lock();
+		}
+
+		lock.unlock();
+		flush();
+	}
+
+	static std::array<std::atomic<Logger*>, 16>& registry()
+	{
+		static std::array<std::atomic<Logger*>, 16> loggers{};
+		return loggers;
+	}
+
+#if defined(SIGBUS)
+	static constexpr std::array<int, 5> fatal_signals{ SIGABRT, SIGSEGV, SIGFPE, SIGILL, SIGBUS };
+#else
+	static constexpr std::array<int, 4> fatal_signals{ SIGABRT, SIGSEGV, SIGFPE, SIGILL };
+#endif
+
+#if defined(_WIN32)
+	using SignalAction = void (*)(int);
+#else
+	using SignalAction = struct sigaction;
+#endif
+
+	// The handlers that were installed before catch_fatal_signals().
+	static std::array<SignalAction, fatal_signals.size()>& previous_signals()
+	{
+		static std::array<SignalAction, fatal_signals.size()> actions{};
+		return actions;
+	}
+
+#if defined(_WIN32)
+	static void crash_signal(int sig)
+	{
+		flush_all_on_crash();
+
+		for (size_t i = 0; i < fatal_signals.size(); i++) {
+			SignalAction previous = previous_signals()[i];
+
+			if (fatal_signals[i] == sig && previous != SIG_DFL && previous != SIG_IGN && previous != SIG_ERR && previous) {
+				previous(sig);
+				return;
+			}
+		}
+
+		std::signal(sig, SIG_DFL);
+		std::raise(sig);
+	}
+#else
+	static void crash_signal(int sig, siginfo_t* info, void* context)
+	{
+		flush_all_on_crash();
+
+		for (size_t i = 0; i < fatal_signals.size(); i++) {
+			if (fatal_signals[i] != sig) {
+				continue;
+			}
+
+			const struct sigaction& previous = previous_signals()[i];
+
+			if (previous.sa_flags & SA_SIGINFO) {
+				previous.sa_sigaction(sig, info, context);
+				return;
+			}
+
+			if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+				previous.sa_handler(sig);
+				return;
+			}
+
+			// Put the previous action back, so the signal raised again (or the fault, when the handler returns) gets it.
+			sigaction(sig, &previous, nullptr);
+			break;
+		}
+
+		raise(sig);
+	}
+#endif
+
+	// Put [add] in the place of [remove] in the registry of loggers flushed on crashes.
+	// The terminate handler is installed with the first registered logger, it calls the previous one after flushing.
+	static void enroll(Logger* add, Logger* remove = nullptr)
+	{
+		static std::once_flag installed;
+
+		std::call_once(installed, []() {
+			static std::terminate_handler previous = std::set_terminate([]() {
+				flush_all_on_crash();
+
+				if (previous) {
+					previous();
+				}
+
+				std::abort();
+			});
+		});
+
+		for (std::atomic<Logger*>& slot : registry()) {
+			Logger* expected = remove;
+
+			if (slot.compare_exchange_strong(expected, add)) {
+				return;
+			}
+		}
+	}
+};
+
+// Watches a file in a background thread and calls a function after it changes.
+// The directory of the file is watched, so files replaced by renaming another file over them (atomic saves) are followed too.
+// Uses inotify on Linux, kqueue on BSD and macOS, ReadDirectoryChangesW on Windows, and polls the modification time elsewhere.
+// Note: [on_change] is called on the watcher thread, and can be called more than once for a single change.
+struct FileWatcher
+{
+	// Parameters:
+	//   [on_change] Called after the file was written, created or replaced.
+	//   [interval] How often the thread checks if it has to stop, and how often the file is polled when there are no change notifications.
+	FileWatcher(
+		const char* name,
+		std::function<void()> on_change,
+		std::chrono::milliseconds interval = std::chrono::milliseconds(100)
+	) : path(name), on_change(std::move(on_change)), interval(interval) {
+		size_t slash = path.find_last_of("/\\");
+
+		dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+		file = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+		// Changes are caught from the moment the constructor returns.
+		std::future<void> watching = started.get_future();
+
+		thread = std::thread([this]() {
+			run();
+			watch_started();
+		});
+
+		watching.wait();
+	}
+
+	~FileWatcher()
+	{
+		stop = true;
+		thread.join();
+	}
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+private:
+	std::string path;
+	std::string dir;
+	std::string file;
+	std::function<void()> on_change;
+	std::chrono::milliseconds interval;
+	std::atomic<bool> stop{ false };
+	std::promise<void> started;
+	bool started_set = false;
+	std::thread thread;
+
+	// Let the constructor return, called by the watcher thread once changes are being caught.
+	void watch_started()
+	{
+		if (!started_set) {
+			started_set = true;
+			started.set_value();
+		}
+	}
+
+#if defined(RW_INOTIFY)
+	void run()
+	{
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			if (fd >= 0)
+				::close(fd);
+
+			poll_stat();
+			return;
+		}
+
+		alignas(inotify_event) char events[4096];
+		pollfd pfd = { fd, POLLIN, 0 };
+
+		watch_started();
+
+		while (!stop) {
+			if (::poll(&pfd, 1, (int)interval.count()) <= 0) {
+				continue;
+			}
+
+			bool changed = false;
+			ssize_t got;
+
+			while ((got = ::read(fd, events, sizeof(events))) > 0) {
+				for (char* p = events; p < events + got;) {
+					const inotify_event* event = (const inotify_event*)p;
+
+					if (event->len && file == event->name)
+						changed = true;
+
+					p += sizeof(inotify_event) + event->len;
+				}
+			}
+
+			if (changed) {
+				on_change();
+			}
+		}
+
+		::close(fd);
+	}
+#elif defined(RW_KQUEUE)
+	void run()
+	{
+#if defined(O_EVTONLY)
+		const int oflags = O_EVTONLY;
+#else
+		const int oflags = O_RDONLY;
+#endif
+		int kq = kqueue();
+		int dir_fd = ::open(dir.c_str(), oflags);
+		int file_fd = -1;
+
+		if (kq < 0 || dir_fd < 0) {
+			if (kq >= 0)
+				::close(kq);
+
+			if (dir_fd >= 0)
+				::close(dir_fd);
+
+			poll_stat();
+			return;
+		}
+
+		struct kevent change;
+
+		EV_SET(&change, dir_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, nullptr);
+		kevent(kq, &change, 1, nullptr, 0, nullptr);
+
+		// A file replaced by a rename is a new file, it has to be opened again to be watched.
+		// Closing the old descriptor removes its event.
+		auto watch_file = [&]() {
+			if (file_fd >= 0)
+				::close(file_fd);
+
+			file_fd = ::open(path.c_str(), oflags);
+
+			if (file_fd >= 0) {
+				EV_SET(&change, file_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr);
+				kevent(kq, &change, 1, nullptr, 0, nullptr);
+			}
+		};
+
+		watch_file();
+		watch_started();
+
+		while (!stop) {
+			struct kevent events[8];
+			timespec timeout = { (time_t)(interval.count() / 1000), (long)(interval.count() % 1000) * 1000000 };
+			int n = kevent(kq, nullptr, 0, events, 8, &timeout);
+
+			if (n <= 0) {
+				continue;
+			}
+
+			bool replaced = false;
+
+			for (int i = 0; i < n; i++) {
+				if ((int)events[i].ident == dir_fd || (events[i].fflags & (NOTE_DELETE | NOTE_RENAME)))
+					replaced = true;
+			}
+
+			if (replaced)
+				watch_file();
+
+			on_change();
+		}
+
+		if (file_fd >= 0)
+			::close(file_fd);
+
+		::close(dir_fd);
+		::close(kq);
+	}
+#elif defined(_WIN32)
+	void run()
+	{
+		HANDLE dir_handle = CreateFileA(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+
+		if (dir_handle == INVALID_HANDLE_VALUE) {
+			poll_stat();
+			return;
+		}
+
+		std::wstring wide_file(MultiByteToWideChar(CP_ACP, 0, file.c_str(), (int)file.size(), nullptr, 0), L'\0');
+		MultiByteToWideChar(CP_ACP, 0, file.c_str(), (int)file.size(), wide_file.data(), (int)wide_file.size());
+
+		alignas(DWORD) char events[16384];
+		OVERLAPPED overlapped = {};
+		bool pending = false;
+
+		overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+		while (!stop) {
+			if (!pending) {
+				ResetEvent(overlapped.hEvent);
+
+				if (!ReadDirectoryChangesW(dir_handle, events, sizeof(events), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, nullptr, &overlapped, nullptr)) {
+					break;
+				}
+
+				pending = true;
+				watch_started();
+			}
+
+			if (WaitForSingleObject(overlapped.hEvent, (DWORD)interval.count()) != WAIT_OBJECT_0) {
+				continue;
+			}
+
+			DWORD got = 0;
+			pending = false;
+
+			if (!GetOverlappedResult(dir_handle, &overlapped, &got, FALSE)) {
+				break;
+			}
+
+			// Nothing is returned if there were too many changes for the buffer, the file may be one of them.
+			bool changed = (got == 0);
+
+			for (char* p = events; got;) {
+				const FILE_NOTIFY_INFORMATION* event = (const FILE_NOTIFY_INFORMATION*)p;
+				size_t length = event->FileNameLength / sizeof(WCHAR);
+
+				if (length == wide_file.size() && _wcsnicmp(event->FileName, wide_file.c_str(), length) == 0)
+					changed = true;
+
+				if (!event->NextEntryOffset) {
+					break;
+				}
+
+				p += event->NextEntryOffset;
+			}
+
+			if (changed) {
+				on_change();
+			}
+		}
+
+		if (pending) {
+			DWORD got = 0;
+			CancelIo(dir_handle);
+			GetOverlappedResult(dir_handle, &overlapped, &got, TRUE);
+		}
+
+		CloseHandle(overlapped.hEvent);
+		CloseHandle(dir_handle);
+	}
+#else
+	void run() { poll_stat(); }
+#endif
+
+	// Watch the file by checking its modification time and size every [interval].
+	void poll_stat()
+	{
+		FileInfo last = file_info(path.c_str());
+
+		watch_started();
+
+		while (!stop) {
+			std::this_thread::sleep_for(interval);
+
+			FileInfo info = file_info(path.c_str());
+
+			if (info.exists && (!last.exists || info.mtime != last.mtime || info.size != last.size)) {
+				on_change();
+			}
+
+			last = info;
+		}
+	}
+};
+
+
+// String with [N] characters of inline storage, moving to the heap only when it grows longer.
+// Used as the storage of inline_concat.
+template<size_t N>
+struct InlineString
+{
+	InlineString() = default;
+	InlineString(const InlineString& other) { *this += other.view(); }
+
+	InlineString& operator=(const InlineString& other)
+	{
+		if (this != &other) {
+			clear();
+			*this += other.view();
+		}
+		return *this;
+	}
+
+	const char* data() const { return (on_heap) ? heap.data() : buf; }
+	const char* c_str() const { return data(); }
+	size_t size() const { return (on_heap) ? heap.size() : len; }
+	std::string_view view() const { return { data(), size() }; }
+
+	void clear()
+	{
+		heap.clear();
+		on_heap = false;
+		len = 0;
+		buf[0] = '\0';
+	}
+
+	void reserve(size_t capacity)
+	{
+		if (capacity > N)
+			spill(capacity);
+	}
+
+	InlineString& operator+=(std::string_view str)
+	{
+		if (!on_heap && str.size() <= N - len) {
+			memcpy(buf + len, str.data(), str.size());
+			len += str.size();
+			buf[len] = '\0';
+		}
+		else {
+			spill(size() + str.size());
+			heap += str;
+		}
+		return *this;
+	}
+
+	InlineString& append(size_t count, char c)
+	{
+		if (!on_heap && count <= N - len) {
+			memset(buf + len, c, count);
+			len += count;
+			buf[len] = '\0';
+		}
+		else {
+			spill(size() + count);
+			heap.append(count, c);
+		}
+		return *this;
+	}
+
+private:
+	char buf[N + 1] = {};
+	size_t len = 0;
+	bool on_heap = false;
+	std::string heap;
+
+	void spill(size_t capacity)
+	{
+		if (!on_heap) {
+			heap.reserve(capacity);
+			heap.assign(buf, len);
+			on_heap = true;
+		}
+		else {
+			heap.reserve(capacity);
+		}
+	}
+};
+
+// Create strings by chaining operators.
+// <String> is the storage, std::string for concat, or an InlineString for inline_concat.
+// Numbers are formatted with std::to_chars into a stack buffer, with the same output as std::to_string.
+template<typename String = std::string>
+struct basic_concat
+{
+	operator const char*() const { return str.c_str(); }
+
+	std::exception error() const { return std::exception(str.c_str()); }
+
+	basic_concat(const char* msg = "") { str += msg; }
+	basic_concat(const std::string& msg) { str += msg; }
+
+	// Get a view of the string.
+	std::string_view view() const { return { str.data(), str.size() }; }
+
+	// Reserve space for a string of [capacity] characters.
+	basic_concat& reserve(size_t capacity)
+	{
+		str.reserve(capacity);
+		return *this;
+	}
+
+	// Append string to the string.
+	basic_concat& operator()(const char* msg)
+	{
+		str += msg;
+		return *this;
+	}
+
+	// Append string to the string.
+	basic_concat& operator()(const std::string& msg)
+	{
+		str += msg;
+		return *this;
+	}
+
+	// Append string to the string.
+	basic_concat& operator()(std::string_view msg)
+	{
+		str += msg;
+		return *this;
+	}
+
+	// Append [count] characters to the string.
+	basic_concat& operator()(char c, size_t count = 1)
+	{
+		str.append(count, c);
+		return *this;
+	}
+	
+	// Append a value to the string.
+	// Integers and floating point numbers are formatted without allocating.
+	// Other types <T> must have 'to_string' function that takes [val] as the parameter and returns std::string.
+	template<typename T>
+	basic_concat& operator()(const T& val)
+	{
+		if constexpr (std::is_integral_v<T>) {
+			// Room for all digits and a sign, also for extended integer types such as __int128.
+			char buf[std::numeric_limits<T>::digits10 + 3];
+			std::to_chars_result result = std::to_chars(buf, buf + sizeof(buf), (std::is_same_v<T, bool>) ? (int)val : val);
+
+			if (result.ec == std::errc()) {
+				str += std::string_view(buf, result.ptr - buf);
+			}
+		}
+#if defined(__cpp_lib_to_chars)
+		else if constexpr (std::is_floating_point_v<T>) {
+			// std::to_string formats like printf("%f").
+			char buf[std::numeric_limits<T>::max_exponent10 + 32];
+			char* end = std::to_chars(buf, buf + sizeof(buf), val, std::chars_format::fixed, 6).ptr;
+
+			str += std::string_view(buf, end - buf);
+		}
+#endif
+		else {
+			using std::to_string;
+
+			str += to_string(val);
+		}
+		return *this;
+	}
+
+	// Write the string to a stream with a write(data, size) function, such as WriteStream.
+	template<typename Stream>
+	void write_to(Stream& stream) const { stream.write(str.data(), str.size()); }
+
+	// Write the string to a file stream.
+	void write_to(FILE* f) const { fwrite(str.data(), 1, str.size(), f); }
+
+	String str;
+};
+
+using concat = basic_concat<>;
+
+// Concat that keeps strings up to [N] characters in inline storage, so building short messages does not allocate.
+template<size_t N = 256>
+using inline_concat = basic_concat<InlineString<N>>;
+
+namespace detail
+{
+
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+constexpr bool little_endian = true;
+#else
+constexpr bool little_endian = false;
+#endif
+
+template<typename U>
+U byteswap(U value)
+{
+	if constexpr (sizeof(U) == 1) {
+		return value;
+	}
+#if defined(_MSC_VER)
+	else if constexpr (sizeof(U) == 2) {
+		return _byteswap_ushort(value);
+	}
+	else if constexpr (sizeof(U) == 4) {
+		return _byteswap_ulong(value);
+	}
+	else {
+		return _byteswap_uint64(value);
+	}
+#else
+	else if constexpr (sizeof(U) == 2) {
+		return __builtin_bswap16(value);
+	}
+	else if constexpr (sizeof(U) == 4) {
+		return __builtin_bswap32(value);
+	}
+	else {
+		return __builtin_bswap64(value);
+	}
+#endif
+}
+
+// Reverse the byte order of an arithmetic value if [swap] is true.
+template<typename T>
+T swap_order(T value, bool swap)
+{
+	static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8), "Byte order conversion needs an arithmetic type of 1, 2, 4 or 8 bytes.");
+
+	using U = std::conditional_t<sizeof(T) == 1, uint8_t, std::conditional_t<sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+
+	if (swap) {
+		U bits;
+
+		memcpy(&bits, &value, sizeof(T));
+		bits = byteswap(bits);
+		memcpy(&value, &bits, sizeof(T));
+	}
+
+	return value;
+}
+
+// Tables for Stream VByte decoding, indexed by a control byte that holds the byte lengths (minus 1) of 4 values.
+struct VByteTables
+{
+	uint8_t shuffle[256][16]; // Moves the bytes of the 4 values into 4 little endian uint32 lanes, 0x80 zeroes a byte.
+	uint8_t length[256]; // Total number of data bytes of the 4 values.
+};
+
+constexpr VByteTables make_vbyte_tables()
+{
+	VByteTables tables{};
+
+	for (unsigned c = 0; c < 256; c++) {
+		unsigned at = 0;
+
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned len = ((c >> (i * 2)) & 3) + 1;
+
+			for (unsigned b = 0; b < 4; b++)
+				tables.shuffle[c][i * 4 + b] = (b < len) ? (uint8_t)(at + b) : 0x80;
+
+			at += len;
+		}
+
+		tables.length[c] = (uint8_t)at;
+	}
+
+	return tables;
+}
+
+constexpr VByteTables vbyte_tables = make_vbyte_tables();
+
+// Number of bytes of a value in Stream VByte encoding (1 to 4).
+constexpr unsigned vbyte_length(uint32_t value)
+{
+	return (value < (1u << 8)) ? 1 : (value < (1u << 16)) ? 2 : (value < (1u << 24)) ? 3 : 4;
+}
+
+} // namespace detail
+
+// A read-only stream of data with a position pointer, data pointer and size.
+// Read operations move the position pointer forward.
+// This is used to read embedded data without extra copying costs.
+struct ReadStream
+{
+	const char* data;
+	size_t size;
+	size_t pos = 0; // The current read position.
+
+	ReadStream(const char* data, size_t size) : data(data), size(size) {}
+
+	// Check if the read position pointer is not at or past the end of the stream.
+	operator bool() const { return pos < size; }
+
+	// Find a string in the data, starting from the read position pointer location.
+	// Returns:
+	// - -1 if [str] is empty, or if the read position pointer value is bigger than the size of the stream.
+	// - The size of the stream if [str] is not found.
+	// - The location of the first character of [str] if [str] is found.
+	size_t find(std::string_view str) const
+	{
+		return pos + find_sequence(data + pos, (size < pos) ? 0 : size - pos, str.data(), str.size());
+	}
+
+	// Read a value.
+	// If there are fewer than sizeof(T) bytes left, the missing bytes of the value are zero.
+	template<typename T>
+	T read()
+	{
+		T t{};
+
+		if constexpr (std::is_trivially_copyable_v<T>) {
+			if (pos < size && size - pos >= sizeof(T)) {
+				memcpy(&t, data + pos, sizeof(T));
+				pos += sizeof(T);
+				RW_COUNT(bytes_read, sizeof(T));
+				return t;
+			}
+		}
+
+		read(&t, sizeof(T));
+		return t;
+	}
+
+	// Read bytes into destination, returns the number of bytes read.
+	size_t read(void* destination, size_t readsize)
+	{
+		if (pos >= size) {
+			return 0;
+		}
+
+		if (readsize > size - pos)
+			readsize = size - pos;
+
+		memcpy(destination, data + pos, readsize);
+		pos += readsize;
+		RW_COUNT(bytes_read, readsize);
+		return readsize;
+	}
+
+	// Read a value, or return false without reading anything if there are fewer than sizeof(T) bytes left.
+	template<typename T>
+	bool tryRead(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are copied from the stream bytes.");
+
+		if (!ensure(sizeof(T))) {
+			return false;
+		}
+
+		value = readUnchecked<T>();
+		return true;
+	}
+
+	// Read [readsize] bytes into destination, or return false without reading anything if there are fewer bytes left.
+	bool tryRead(void* destination, size_t readsize)
+	{
+		if (!ensure(readsize)) {
+			return false;
+		}
+
+		readUnchecked(destination, readsize);
+		return true;
+	}
+
+	// Check if there are at least [num_bytes] bytes left to read.
+	// After a successful check, up to [num_bytes] bytes can be read with the unchecked reads:
+	//   if (rs.ensure(count * 4))
+	//       for (size_t i = 0; i < count; i++)
+	//           values[i] = rs.readUnchecked<uint32_t>();
+	bool ensure(size_t num_bytes) const { return pos <= size && size - pos >= num_bytes; }
+
+	// Read a value without checking the size of the stream, see ensure().
+	template<typename T>
+	T readUnchecked()
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are copied from the stream bytes.");
+
+		T t;
+		memcpy(&t, data + pos, sizeof(T));
+		pos += sizeof(T);
+		RW_COUNT(bytes_read, sizeof(T));
+		return t;
+	}
+
+	// Read [readsize] bytes into destination without checking the size of the stream, see ensure().
+	void readUnchecked(void* destination, size_t readsize)
+	{
+		memcpy(destination, data + pos, readsize);
+		pos += readsize;
+		RW_COUNT(bytes_read, readsize);
+	}
+
+	// Read up to [count] values into an array with a single copy, returns the number of values read.
+	// Only whole values are read, a partial value at the end of the stream is left unread.
+	template<typename T>
+	size_t read_into(T* values, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are copied from the stream bytes.");
+
+		size_t left = (pos < size) ? (size - pos) / sizeof(T) : 0;
+
+		count = std::min(count, left);
+		readUnchecked(values, count * sizeof(T));
+		return count;
+	}
+
+#if defined(__cpp_lib_span)
+	// Read values into a span, see read_into(T*, size_t).
+	template<typename T, size_t Extent>
+	size_t read_into(std::span<T, Extent> values) { return read_into(values.data(), values.size()); }
+#endif
+	
+	// Read up to [num_bytes] bytes without copying them.
+	std::string_view readView(size_t num_bytes)
+	{
+		if (pos >= size) {
+			return {};
+		}
+
+		if (num_bytes > size - pos)
+			num_bytes = size - pos;
+
+		std::string_view str(data + pos, num_bytes);
+
+		pos += num_bytes;
+		RW_COUNT(bytes_read, num_bytes);
+		return str;
+	}
+
+#if defined(__cpp_lib_span)
+	// Read up to [num_bytes] bytes without copying them, see readView().
+	std::span<const uint8_t> readSpan(size_t num_bytes)
+	{
+		std::string_view str = readView(num_bytes);
+		return { (const uint8_t*)str.data(), str.size() };
+	}
+#endif
+
+	// Get a stream over the next [num_bytes] bytes (or fewer at the end of the stream) and move the read position pointer past them.
+	// The data is not copied, so records can be handed to a nested parser that cannot read past their end.
+	ReadStream subStream(size_t num_bytes)
+	{
+		std::string_view str = readView(num_bytes);
+		return { str.data(), str.size() };
+	}
+
+	// Get a value without moving the read position pointer, see read().
+	// Peeked bytes are not counted as read by the instrumentation.
+	template<typename T>
+	T peek() const
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are copied from the stream bytes.");
+
+		T t{};
+
+		if (pos < size)
+			memcpy((void*)&t, data + pos, std::min(sizeof(T), size - pos));
+
+		return t;
+	}
+
+	// Get up to [num_bytes] bytes without copying them or moving the read position pointer.
+	std::string_view peekView(size_t num_bytes) const
+	{
+		if (pos >= size) {
+			return {};
+		}
+
+		return { data + pos, std::min(num_bytes, size - pos) };
+	}
+
+	// Move the read position pointer forward by up to [num_bytes] bytes, returns the number of bytes skipped.
+	size_t skip(size_t num_bytes) { return readView(num_bytes).size(); }
+
+	// Read the data in range [read position pointer; _pos).
+	std::string readUntil(size_t _pos) { return std::string(readUntilView(_pos)); }
+
+	// Read the data in range [read position pointer; _pos) without copying it.
+	std::string_view readUntilView(size_t _pos) { return (_pos < pos) ? std::string_view() : readView(_pos - pos); }
+
+	// Read the data all the way until [rule] is not met.
+	// [rule] is any callable taking a char and returning bool, it is called directly so it can be inlined.
+	// Note: The position pointer will be incremented, regardless if [rule] is met.
+	template<typename Rule>
+	std::string readWhile(Rule&& rule) { return std::string(readWhileView(std::forward<Rule>(rule))); }
+
+	// Read the data all the way until [rule] is not met without copying it, see readWhile().
+	template<typename Rule>
+	std::string_view readWhileView(Rule&& rule)
+	{
+		size_t begin = pos;
+		size_t chars = 0;
+
+		while (pos < size) {
+			if (!rule(data[pos++])) {
+				break;
+			}
+			else {
+				chars++;
+			}
+		}
+
+		RW_COUNT(bytes_read, pos - begin);
+		return { data + begin, chars };
+	}
+
+	// Read the data until the first occurence of [c], or until the end of the stream if there is none.
+	// The read position pointer is moved past [c]. The returned view does not include [c].
+	std::string_view readUntilByte(char c)
+	{
+		if (pos >= size) {
+			return {};
+		}
+
+		const char* begin = data + pos;
+		const char* found = (const char*)memchr(begin, c, size - pos);
+
+		if (!found) {
+			RW_COUNT(bytes_read, size - pos);
+			pos = size;
+			return { begin, size_t(data + size - begin) };
+		}
+
+		RW_COUNT(bytes_read, found - begin + 1);
+		pos = found - data + 1;
+		return { begin, size_t(found - begin) };
+	}
+
+	// Read a line, the returned view does not include the newline character.
+	std::string_view readLine() { return readUntilByte('\n'); }
+
+	// Read a little endian value, see read().
+	template<typename T>
+	T read_le() { return detail::swap_order(read<T>(), !detail::little_endian); }
+
+	// Read a big endian value, see read().
+	template<typename T>
+	T read_be() { return detail::swap_order(read<T>(), detail::little_endian); }
+
+	// Read an unsigned LEB128 variable-length integer into [value].
+	// Returns false without moving the read position pointer if the stream ends before the last byte,
+	// or if the integer is longer than 64 bits.
+	bool tryRead_varint(uint64_t& value)
+	{
+		uint64_t result = 0;
+
+		for (size_t at = pos, shift = 0; at < size; shift += 7) {
+			uint8_t b = (uint8_t)data[at++];
+
+			// The 10th byte holds only bit 63, and must be the last one.
+			if (shift == 63 && b > 1) {
+				return false;
+			}
+
+			result |= uint64_t(b & 0x7F) << shift;
+
+			if (!(b & 0x80)) {
+				RW_COUNT(bytes_read, at - pos);
+				pos = at;
+				value = result;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Read an unsigned LEB128 variable-length integer.
+	// Returns 0 if the stream ends before the last byte, or if the integer is longer than 64 bits.
+	// Note: The read position pointer moves past an invalid integer as well, by up to 10 bytes.
+	// Use tryRead_varint() to tell an invalid integer from a 0.
+	uint64_t read_varint()
+	{
+		uint64_t value = 0;
+
+		if (!tryRead_varint(value)) {
+			skip(10);
+		}
+
+		return value;
+	}
+
+	// Read a signed zigzag LEB128 variable-length integer, see read_varint().
+	int64_t read_zigzag()
+	{
+		uint64_t value = read_varint();
+		return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+	}
+
+	// Read [count] integers in Stream VByte encoding (written by WriteStream::write_varints()), decoding 4 at a time with SIMD.
+	// Returns false without reading anything if the stream is too short.
+	bool read_varints(uint32_t* values, size_t count)
+	{
+		size_t control_size = (count + 3) / 4;
+
+		if (count == 0) {
+			return true;
+		}
+
+		if (pos >= size || size - pos < control_size) {
+			return false;
+		}
+
+		const uint8_t* control = (const uint8_t*)data + pos;
+		const uint8_t* in = control + control_size;
+		const uint8_t* in_end = (const uint8_t*)data + size;
+		size_t data_size = 0;
+
+		for (size_t i = 0; i < count / 4; i++)
+			data_size += detail::vbyte_tables.length[control[i]];
+
+		for (size_t i = count / 4 * 4; i < count; i++)
+			data_size += ((control[i / 4] >> ((i % 4) * 2)) & 3) + 1;
+
+		if ((size_t)(in_end - in) < data_size) {
+			return false;
+		}
+
+		size_t i = 0;
+
+#if (defined(RW_SSSE3) || defined(RW_NEON64))
+		if constexpr (detail::little_endian) {
+			for (; i + 4 <= count && in_end - in >= 16; i += 4) {
+				uint8_t c = control[i / 4];
+
+#if defined(RW_SSSE3)
+				__m128i lanes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)detail::vbyte_tables.shuffle[c]));
+				_mm_storeu_si128((__m128i*)(values + i), lanes);
+#else
+				vst1q_u8((uint8_t*)(values + i), vqtbl1q_u8(vld1q_u8(in), vld1q_u8(detail::vbyte_tables.shuffle[c])));
+#endif
+
+				in += detail::vbyte_tables.length[c];
+			}
+		}
+#endif
+
+		for (; i < count; i++) {
+			unsigned len = ((control[i / 4] >> ((i % 4) * 2)) & 3) + 1;
+			uint32_t value = 0;
+
+			for (unsigned b = 0; b < len; b++)
+				value |= uint32_t(in[b]) << (b * 8);
+
+			values[i] = value;
+			in += len;
+		}
+
+		pos += control_size + data_size;
+		RW_COUNT(bytes_read, control_size + data_size);
+		return true;
+	}
+};
+
+// Read-only memory mapping of a whole file.
+// Files can be read through a ReadStream over the mapping without copying them into memory first.
+// The mapping is released when the object is destroyed, streams over it must not be used after that.
+struct MappedFile
+{
+	const char* data = nullptr;
+	size_t size = 0;
+
+	MappedFile() = default;
+	MappedFile(const char* name) { open(name); }
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept : data(other.data), size(other.size)
+	{
+		other.data = nullptr;
+		other.size = 0;
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other) {
+			close();
+			std::swap(data, other.data);
+			std::swap(size, other.size);
+		}
+		return *this;
+	}
+
+	// Check if a file is mapped.
+	operator bool() const { return data != nullptr; }
+
+	// Get a stream over the whole mapping.
+	ReadStream stream() const { return { data, size }; }
+
+	// Map a file into memory, unmapping the previous one.
+	// Returns false if the file cannot be opened or mapped.
+	bool open(const char* name)
+	{
+		close();
+
+		detail::IOScope io(IOOp::map);
+
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER file_size;
+
+		if (!GetFileSizeEx(file, &file_size)) {
+			CloseHandle(file);
+			return false;
+		}
+
+		if (file_size.QuadPart == 0) {
+			CloseHandle(file);
+			data = "";
+			return true;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+
+		if (!mapping) {
+			return false;
+		}
+
+		// The view keeps the mapping alive after its handle is closed.
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+
+		if (data) {
+			size = (size_t)file_size.QuadPart;
+		}
+#else
+		int fd = ::open(name, O_RDONLY);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat st;
+
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+			::close(fd);
+			return false;
+		}
+
+		if (st.st_size == 0) {
+			::close(fd);
+			data = "";
+			return true;
+		}
+
+		void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (map != MAP_FAILED) {
+			data = (const char*)map;
+			size = (size_t)st.st_size;
+		}
+#endif
+
+		io.done(size);
+		return data != nullptr;
+	}
+
+	// Unmap the file.
+	void close()
+	{
+		if (data && size) {
+#if defined(_WIN32)
+			UnmapViewOfFile(data);
+#else
+			munmap((void*)data, size);
+#endif
+		}
+
+		data = nullptr;
+		size = 0;
+	}
+};
+
+// Contents of files read by read_batch().
+// Small files are packed together into large blocks instead of getting an allocation each.
+struct FileBatch
+{
+	struct Entry
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+		bool ok = false; // False if the file could not be opened or read, or is not a regular file.
+
+		ReadStream stream() const { return { data, size }; }
+	};
+
+	std::vector<Entry> files; // One entry for each path, in the same order.
+	std::vector<std::unique_ptr<char[]>> blocks; // Memory of the file data.
+};
+
+namespace detail
+{
+
+// Allocates the file data read by one read_batch() thread.
+// Blocks start small and double with the data read so far, so a few small files do not take a full block.
+struct BatchArena
+{
+	static constexpr size_t min_block_size = 4 * 1024;
+	static constexpr size_t block_size = 1 << 20;
+	static constexpr size_t small_file = 64 * 1024; // Larger files get a block of their own.
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* next = nullptr;
+	size_t left = 0;
+	size_t allocated = 0; // Bytes in small file blocks so far.
+
+	char* allocate(size_t size)
+	{
+		if (size > small_file) {
+			blocks.emplace_back(new char[size]);
+			return blocks.back().get();
+		}
+
+		if (size > left) {
+			size_t new_size = std::min(block_size, std::max({ size, min_block_size, allocated }));
+
+			blocks.emplace_back(new char[new_size]);
+			next = blocks.back().get();
+			left = new_size;
+			allocated += new_size;
+		}
+
+		char* p = next;
+
+		next += size;
+		left -= size;
+		return p;
+	}
+};
+
+} // namespace detail
+
+// Read many files in binary mode on a pool of threads.
+// Each thread takes the next unread path when it finishes a file, so a few large files do not hold up the rest.
+// Directories, devices and pipes are not read and get an entry with [ok] false.
+// Parameters:
+//   [on_read] If set, called with the index of each path and its data as soon as the file is read, on the thread that read it.
+//   Calls from different threads can run at the same time.
+//   [threads] The number of threads, or 0 for the number of hardware threads.
+// Returns: The data of all files, it stays valid for as long as the returned object.
+FileBatch read_batch(
+	const std::vector<std::string>& paths,
+	const std::function<void(size_t index, const FileBatch::Entry& file)>& on_read = {},
+	unsigned threads = 0
+) {
+	FileBatch batch;
+
+	batch.files.resize(paths.size());
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	threads = (unsigned)std::max<size_t>(1, std::min<size_t>(threads, paths.size()));
+
+	std::atomic<size_t> next{ 0 };
+	std::vector<detail::BatchArena> arenas(threads);
+
+	auto run = [&](detail::BatchArena& arena) {
+		for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < paths.size();) {
+			FileBatch::Entry& entry = batch.files[i];
+			File f(paths[i].c_str());
+			FileInfo info = f.info();
+
+			if (info.regular) {
+				size_t size = (size_t)info.size;
+				int error = 0;
+
+				entry.data = (size != 0) ? arena.allocate(size) : "";
+				entry.size = f.pread((char*)entry.data, size, 0, &error);
+				entry.ok = (error == 0);
+			}
+
+			if (on_read) {
+				on_read(i, entry);
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+
+	for (unsigned t = 1; t < threads; t++)
+		workers.emplace_back([&, t]() { run(arenas[t]); });
+
+	run(arenas[0]);
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	for (detail::BatchArena& arena : arenas) {
+		for (std::unique_ptr<char[]>& block : arena.blocks)
+			batch.blocks.push_back(std::move(block));
+	}
+
+	return batch;
+}
+
+// Get a refill function for StreamReader that reads from a C file stream.
+std::function<size_t(char*, size_t)> file_source(FILE* f)
+{
+	return [f](char* dest, size_t size) {
+		detail::IOScope io(IOOp::read);
+		size_t got = fread(dest, 1, size, f);
+
+		io.done(got);
+		return got;
+	};
+}
+
+// Buffered reader over data that arrives in chunks, such as a FILE* (see file_source()), a pipe or a socket.
+// Chunks are pulled with the refill function into a sliding window, and read data is dropped from the window when it is refilled.
+// Memory use is bounded by the chunk size and the longest single item read.
+// Positions are counted from the beginning of the source.
+// Note: Views returned by read operations are valid until the next read operation.
+struct StreamReader
+{
+	// Reads up to [size] bytes into [dest], returns the number of bytes read, or 0 at the end of the source.
+	using Refill = std::function<size_t(char* dest, size_t size)>;
+
+	Refill refill;
+	size_t chunk_size;
+
+	StreamReader(Refill refill, size_t chunk_size = 64 * 1024) : refill(std::move(refill)), chunk_size((chunk_size) ? chunk_size : 1) {}
+
+	// Check if there is data left to read.
+	operator bool() { return begin < end || fill(1); }
+
+	// Get the current read position.
+	size_t position() const { return offset + begin; }
+
+	// Get the data that is already buffered, starting from the read position.
+	ReadStream window() const { return { buf.data() + begin, end - begin }; }
+
+	// Make sure at least [num_bytes] bytes are buffered after the read position.
+	// Returns false if the source ended before that.
+	bool fill(size_t num_bytes)
+	{
+		while (end - begin < num_bytes) {
+			if (eof) {
+				return false;
+			}
+
+			if (buf.size() - end < chunk_size) {
+				// Slide the unread data to the front before growing the window.
+				if (begin) {
+					memmove(buf.data(), buf.data() + begin, end - begin);
+					offset += begin;
+					end -= begin;
+					begin = 0;
+				}
+
+				if (buf.size() - end < chunk_size)
+					buf.resize(std::max(buf.size() * 2, end + std::max(chunk_size, num_bytes)));
+			}
+
+			size_t got = refill(buf.data() + end, buf.size() - end);
+
+			if (got == 0) {
+				eof = true;
+				return false;
+			}
+
+			end += got;
+		}
+
+		return true;
+	}
+
+	// Find a string in the data, starting from the read position.
+	// Data is buffered until [str] is found.
+	// Returns:
+	// - The read position if [str] is empty.
+	// - The position of the end of the source if [str] is not found.
+	// - The position of the first character of [str] if [str] is found.
+	size_t find(std::string_view str)
+	{
+		size_t searched = 0; // Relative to the read position, the window can move while filling.
+
+		for (;;) {
+			size_t avail = end - begin - searched;
+			size_t found = find_sequence(buf.data() + begin + searched, avail, str.data(), str.size());
+
+			if (found < avail) {
+				return position() + searched + found;
+			}
+
+			// Keep the last [str.size() - 1] bytes, [str] can start in them.
+			if (avail >= str.size())
+				searched += avail - str.size() + 1;
+
+			if (!fill(end - begin + 1)) {
+				return offset + end;
+			}
+		}
+	}
+
+	// Read a value.
+	// If the source ends before sizeof(T) bytes, the missing bytes of the value are zero.
+	template<typename T>
+	T read()
+	{
+		T t{};
+		read(&t, sizeof(T));
+		return t;
+	}
+
+	// Read bytes into destination, returns the number of bytes read.
+	// Large reads go directly from the source into [destination] once the buffered data is used up.
+	size_t read(void* destination, size_t readsize)
+	{
+		char* dest = (char*)destination;
+		size_t done = 0;
+
+		while (done < readsize) {
+			if (begin < end) {
+				size_t n = std::min(readsize - done, end - begin);
+
+				memcpy(dest + done, buf.data() + begin, n);
+				begin += n;
+				done += n;
+			}
+			else if (eof) {
+				break;
+			}
+			else if (readsize - done >= chunk_size) {
+				size_t got = refill(dest + done, readsize - done);
+
+				if (got == 0) {
+					eof = true;
+				}
+
+				done += got;
+				offset += got;
+			}
+			else {
+				fill(readsize - done);
+			}
+		}
+
+		RW_COUNT(bytes_read, done);
+		return done;
+	}
+
+	// Skip [num_bytes] bytes, returns the number of bytes skipped.
+	size_t skip(size_t num_bytes)
+	{
+		size_t done = 0;
+
+		while (done < num_bytes && (begin < end || fill(1))) {
+			size_t n = std::min(num_bytes - done, end - begin);
+
+			begin += n;
+			done += n;
+		}
+
+		RW_COUNT(bytes_read, done);
+		return done;
+	}
+
+	// Read the data in range [read position; _pos).
+	std::string readUntil(size_t _pos)
+	{
+		if (_pos < position()) {
+			return "";
+		}
+
+		std::string str(_pos - position(), '\0');
+
+		str.resize(read(str.data(), str.size()));
+		return str;
+	}
+
+	// Read the data all the way until [rule] is not met, see ReadStream::readWhile().
+	template<typename Rule>
+	std::string readWhile(Rule&& rule)
+	{
+		std::string str;
+
+		while (begin < end || fill(1)) {
+			size_t i = begin;
+
+			while (i < end && rule(buf[i])) {
+				i++;
+			}
+
+			str.append(buf.data() + begin, i - begin);
+			RW_COUNT(bytes_read, i - begin + (i < end));
+
+			if (i < end) {
+				begin = i + 1;
+				break;
+			}
+
+			begin = i;
+		}
+
+		return str;
+	}
+
+	// Read the data until the first occurence of [c], or until the end of the source if there is none.
+	// The read position is moved past [c]. The returned view does not include [c].
+	std::string_view readUntilByte(char c)
+	{
+		size_t searched = 0;
+
+		while (begin + searched < end || fill(searched + 1)) {
+			const char* found = (const char*)memchr(buf.data() + begin + searched, c, end - begin - searched);
+
+			if (found) {
+				std::string_view str(buf.data() + begin, found - buf.data() - begin);
+
+				begin += str.size() + 1;
+				RW_COUNT(bytes_read, str.size() + 1);
+				return str;
+			}
+
+			searched = end - begin;
+		}
+
+		std::string_view str(buf.data() + begin, end - begin);
+
+		begin = end;
+		RW_COUNT(bytes_read, str.size());
+		return str;
+	}
+
+	// Read a line, the returned view does not include the newline character.
+	std::string_view readLine() { return readUntilByte('\n'); }
+
+private:
+	std::vector<char> buf;
+	size_t begin = 0; // Index of the read position in [buf].
+	size_t end = 0; // Index of the end of the buffered data in [buf].
+	size_t offset = 0; // Position of buf[0] in the source.
+	bool eof = false;
+};
+
+// Allocator adaptor that default-initializes elements instead of value-initializing them.
+// Growing a vector of bytes with it leaves the new bytes uninitialized instead of zero-filling them.
+template<typename T, typename A = std::allocator<T>>
+struct default_init_allocator : public A
+{
+	template<typename U>
+	struct rebind { using other = default_init_allocator<U, typename std::allocator_traits<A>::template rebind_alloc<U>>; };
+
+	using A::A;
+
+	default_init_allocator() = default;
+	default_init_allocator(const A& a) noexcept : A(a) {}
+
+	template<typename U, typename B>
+	default_init_allocator(const default_init_allocator<U, B>& other) noexcept : A(static_cast<const B&>(other)) {}
+
+	template<typename U>
+	void construct(U* ptr) noexcept(std::is_nothrow_default_constructible_v<U>) { ::new((void*)ptr) U; }
+
+	template<typename U, typename... Args>
+	void construct(U* ptr, Args&&... args) { std::allocator_traits<A>::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...); }
+};
+
+// Write stream containing a buffer that can be read.
+// Write operations move the position index forward.
+// The buffer grows geometrically, and bytes that are about to be overwritten are not zero-filled first.
+// <Allocator> allocates the buffer, for example a std::pmr::polymorphic_allocator over an arena (see rw::pmr::WriteStream).
+template<typename Allocator = std::allocator<uint8_t>>
+struct BasicWriteStream : public std::vector<uint8_t, default_init_allocator<uint8_t, Allocator>>
+{
+	size_t pos = 0; // Byte position index.
+	size_t prepared = 0; // Number of bytes appended by the last prepare() call that are not committed yet.
+	bool preparing = false; // True from a prepare() call until its commit().
+
+	BasicWriteStream() = default;
+	explicit BasicWriteStream(const Allocator& alloc) : std::vector<uint8_t, default_init_allocator<uint8_t, Allocator>>(alloc) {}
+
+	// Copy the buffer into a plain std::vector<uint8_t>.
+	// Note: The buffer is not a std::vector<uint8_t> itself because of its allocator, so it does not bind to a std::vector<uint8_t>& parameter.
+	std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(this->begin(), this->end()); }
+	explicit operator std::vector<uint8_t>() const { return to_vector(); }
+
+	// Append [num_bytes] zero bytes to the buffer.
+	void expand(size_t num_bytes)
+	{
+		end_prepare();
+		this->resize(this->size() + num_bytes, 0);
+	}
+
+	// Make the buffer at least [new_size] bytes long, growing the capacity geometrically.
+	// Bytes between the old end of the buffer and the position index are zeroed, bytes past the position index are left uninitialized.
+	void grow(size_t new_size)
+	{
+		size_t old_size = this->size();
+
+		if (new_size <= old_size) {
+			return;
+		}
+
+		if (new_size > this->capacity())
+			this->reserve(std::max(new_size, this->capacity() * 2));
+
+		this->resize(new_size);
+
+		if (pos > old_size)
+			memset(this->data() + old_size, 0, std::min(pos, new_size) - old_size);
+	}
+
+	// Get a pointer to write up to [num_bytes] bytes directly at the position index, growing the buffer if needed.
+	// Call commit() with the number of bytes that were actually written.
+	// Note: Bytes past the old end of the buffer are uninitialized until written.
+	// Note: Any other write before commit() ends the prepare(), its bytes are dropped and the pointer must not be used anymore.
+	uint8_t* prepare(size_t num_bytes)
+	{
+		end_prepare();
+
+		size_t old_size = this->size();
+
+		grow(pos + num_bytes);
+		prepared = this->size() - old_size;
+		preparing = true;
+		return this->data() + pos;
+	}
+
+	// Move the position index forward by [num_bytes] written into the pointer returned by prepare().
+	// Prepared bytes past the written ones are removed from the end of the buffer.
+	// Does nothing if there is no prepare() to commit, because another write ended it.
+	void commit(size_t num_bytes)
+	{
+		if (!preparing) {
+			return;
+		}
+
+		pos += num_bytes;
+		RW_COUNT(bytes_written, num_bytes);
+		end_prepare();
+	}
+
+	// End a prepare() without writing more, removing its uncommitted bytes from the end of the buffer.
+	void end_prepare()
+	{
+		if (!preparing) {
+			return;
+		}
+
+		if (prepared)
+			this->resize(std::max(this->size() - prepared, pos));
+
+		prepared = 0;
+		preparing = false;
+	}
+
+	// Write padding bytes to the buffer.
+	void pad(size_t num_bytes) { expand(num_bytes); pos = this->size(); }
+
+	// Write a byte to the buffer.
+	void put(uint8_t b)
+	{
+		end_prepare();
+
+		if (pos >= this->size())
+			grow(pos + 1);
+
+		this->data()[pos++] = b;
+		RW_COUNT(bytes_written, 1);
+	}
+
+	// Write a value to the buffer in binary form.
+	template<typename T>
+	void write(const T& value)
+	{
+		end_prepare();
+
+		if constexpr (std::is_trivially_copyable_v<T>) {
+			if (pos + sizeof(T) <= this->size()) {
+				memcpy(this->data() + pos, &value, sizeof(T));
+				pos += sizeof(T);
+				RW_COUNT(bytes_written, sizeof(T));
+				return;
+			}
+		}
+
+		write((uint8_t*)&value, sizeof(T));
+	}
+
+	// Write [writesize] bytes from source to the buffer.
+	void write(const void* source, size_t writesize)
+	{
+		end_prepare();
+
+		if (writesize + pos > this->size())
+			grow(writesize + pos);
+
+		if (writesize) {
+			memcpy(this->data() + pos, source, writesize);
+			pos += writesize;
+			RW_COUNT(bytes_written, writesize);
+		}
+	}
+
+	// Write an array of [count] values with a single copy.
+	template<typename T>
+	void write_array(const T* values, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are written as their bytes.");
+		write((const void*)values, count * sizeof(T));
+	}
+
+#if defined(__cpp_lib_span)
+	// Write the values of a span with a single copy, see write_array().
+	template<typename T, size_t Extent>
+	void write(std::span<T, Extent> values) { write_array(values.data(), values.size()); }
+#endif
+
+	// Write a value in little endian byte order.
+	template<typename T>
+	void write_le(T value) { write(detail::swap_order(value, !detail::little_endian)); }
+
+	// Write a value in big endian byte order.
+	template<typename T>
+	void write_be(T value) { write(detail::swap_order(value, detail::little_endian)); }
+
+	// Write an unsigned LEB128 variable-length integer: 7 bits per byte, small values take a single byte.
+	void write_varint(uint64_t value)
+	{
+		uint8_t* out = prepare(10);
+		size_t n = 0;
+
+		for (; value >= 0x80; value >>= 7)
+			out[n++] = (uint8_t)value | 0x80;
+
+		out[n++] = (uint8_t)value;
+		commit(n);
+	}
+
+	// Write a signed integer as a zigzag LEB128 variable-length integer, so that small negative values are short too.
+	void write_zigzag(int64_t value) { write_varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63)); }
+
+	// Write [count] integers in Stream VByte encoding: 2-bit byte lengths for 4 values per control byte, followed by the value bytes.
+	// The count is not written, ReadStream::read_varints() has to be given the same count.
+	void write_varints(const uint32_t* values, size_t count)
+	{
+		if (count == 0) {
+			return;
+		}
+
+		size_t control_size = (count + 3) / 4;
+		uint8_t* control = prepare(control_size + count * 4);
+		uint8_t* out = control + control_size;
+
+		memset(control, 0, control_size);
+
+		for (size_t i = 0; i < count; i++) {
+			uint32_t value = values[i];
+			unsigned len = detail::vbyte_length(value);
+
+			control[i / 4] |= (uint8_t)((len - 1) << ((i % 4) * 2));
+
+			for (unsigned b = 0; b < len; b++)
+				out[b] = (uint8_t)(value >> (b * 8));
+
+			out += len;
+		}
+
+		commit(out - control);
+	}
+};
+
+using WriteStream = BasicWriteStream<>;
+
+#if defined(__cpp_lib_memory_resource)
+namespace pmr
+{
+
+// Write stream allocating its buffer from a memory resource, such as a std::pmr::monotonic_buffer_resource that is released all at once.
+using WriteStream = BasicWriteStream<std::pmr::polymorphic_allocator<uint8_t>>;
+
+} // namespace pmr
+#endif
+
+namespace detail
+{
+
+template<typename M>
+struct member_pointer;
+
+template<typename C, typename F>
+struct member_pointer<F C::*>
+{
+	using Class = C;
+	using Field = F;
+};
+
+} // namespace detail
+
+// Description of a struct as a list of its fields, to write and read it without the padding between them:
+//   struct Sample { uint8_t channel; double time; float value; };
+//   using SampleFields = rw::Packed<&Sample::channel, &Sample::time, &Sample::value>;
+//   SampleFields::write_array(ws, samples.data(), samples.size()); // 13 bytes per sample instead of 24.
+// Fields are written in the listed order and in native byte order, like WriteStream::write().
+// Arrays of structs that are listed in declaration order and have no padding are copied with a single memcpy.
+template<auto First, auto... Rest>
+struct Packed
+{
+	using Type = typename detail::member_pointer<decltype(First)>::Class;
+
+	static_assert((std::is_same_v<Type, typename detail::member_pointer<decltype(Rest)>::Class> && ...), "All fields have to be members of the same struct.");
+	static_assert(std::is_trivially_copyable_v<typename detail::member_pointer<decltype(First)>::Field> && (std::is_trivially_copyable_v<typename detail::member_pointer<decltype(Rest)>::Field> && ...), "Fields are written as their bytes.");
+
+	// Size of a packed value in bytes.
+	static constexpr size_t size = (sizeof(typename detail::member_pointer<decltype(First)>::Field) + ... + sizeof(typename detail::member_pointer<decltype(Rest)>::Field));
+
+	// Copy the fields of [value] to [dest], which must have room for [size] bytes.
+	static void pack(const Type& value, char* dest)
+	{
+		memcpy(dest, &(value.*First), sizeof(value.*First));
+		size_t at = sizeof(value.*First);
+		((memcpy(dest + at, &(value.*Rest), sizeof(value.*Rest)), at += sizeof(value.*Rest)), ...);
+	}
+
+	// Copy [size] bytes from [source] to the fields of [value].
+	static void unpack(const char* source, Type& value)
+	{
+		memcpy(&(value.*First), source, sizeof(value.*First));
+		size_t at = sizeof(value.*First);
+		((memcpy(&(value.*Rest), source + at, sizeof(value.*Rest)), at += sizeof(value.*Rest)), ...);
+	}
+
+	// Check if the packed form is the struct itself: the fields are listed in declaration order and there is no padding.
+	static bool same_layout()
+	{
+		if constexpr (size != sizeof(Type) || !std::is_trivially_copyable_v<Type> || !std::is_default_constructible_v<Type>) {
+			return false;
+		}
+		else {
+			static const bool same = []() {
+				Type probe{};
+				const char* base = (const char*)&probe;
+				bool in_order = ((const char*)&(probe.*First) == base);
+				size_t at = sizeof(probe.*First);
+
+				((in_order &= ((const char*)&(probe.*Rest) - base == (ptrdiff_t)at), at += sizeof(probe.*Rest)), ...);
+				return in_order;
+			}();
+
+			return same;
+		}
+	}
+
+	// Write the fields of a value.
+	template<typename Allocator>
+	static void write(BasicWriteStream<Allocator>& ws, const Type& value)
+	{
+		pack(value, (char*)ws.prepare(size));
+		ws.commit(size);
+	}
+
+	// Write an array of [count] values into one presized block of the stream.
+	template<typename Allocator>
+	static void write_array(BasicWriteStream<Allocator>& ws, const Type* values, size_t count)
+	{
+		if (same_layout()) {
+			ws.write((const void*)values, count * size);
+			return;
+		}
+
+		char* out = (char*)ws.prepare(count * size);
+
+		for (size_t i = 0; i < count; i++)
+			pack(values[i], out + i * size);
+
+		ws.commit(count * size);
+	}
+
+	// Read the fields of a value, or return false without reading anything if there are fewer than [size] bytes left.
+	static bool read(ReadStream& rs, Type& value)
+	{
+		if (!rs.ensure(size)) {
+			return false;
+		}
+
+		unpack(rs.readView(size).data(), value);
+		return true;
+	}
+
+	// Read up to [count] values into an array, returns the number of values read.
+	// Only whole values are read, see ReadStream::read_into().
+	static size_t read_array(ReadStream& rs, Type* values, size_t count)
+	{
+		count = std::min(count, (rs.pos < rs.size) ? (rs.size - rs.pos) / size : 0);
+
+		if (!count) {
+			return 0;
+		}
+
+		const char* in = rs.readView(count * size).data();
+
+		if (same_layout()) {
+			memcpy((void*)values, in, count * size);
+			return count;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			unpack(in + i * size, values[i]);
+
+		return count;
+	}
+};
+
+// Compression codec for CompressedWriter and the compressed readers, as plain functions so other libraries (LZ4, Zstd, ...) are easy to plug in.
+// Blocks are never empty, and a return value of 0 always means failure.
+struct Codec
+{
+	uint32_t id; // Stored in the frame header, readers only accept frames with the id of their codec.
+	size_t (*bound)(size_t size); // The largest compressed size of [size] bytes.
+	size_t (*compress)(const char* source, size_t size, char* dest, size_t capacity); // Returns the compressed size, or 0 if it does not fit.
+	size_t (*decompress)(const char* source, size_t size, char* dest, size_t capacity); // Returns the decompressed size, or 0 if the data is invalid.
+};
+
+namespace detail
+{
+
+template<typename T>
+void store_le(char* dest, T value)
+{
+	value = swap_order(value, !little_endian);
+	memcpy(dest, &value, sizeof(T));
+}
+
+template<typename T>
+T load_le(const char* source)
+{
+	T value;
+	memcpy(&value, source, sizeof(T));
+	return swap_order(value, !little_endian);
+}
+
+size_t lz_bound(size_t size) { return size + size / 255 + 16; }
+
+// Append an LZ4 length: the rest of a length that did not fit in the 4 bits of the token, in bytes of up to 255.
+uint8_t* lz_put_length(uint8_t* out, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*out++ = 255;
+
+	*out++ = (uint8_t)length;
+	return out;
+}
+
+// Compress a block into the LZ4 block format, finding matches with a hash table of 4-byte sequences.
+size_t lz_compress(const char* source, size_t size, char* dest, size_t capacity)
+{
+	// The format requires the last 5 bytes to be literals, and the last match to start at least 12 bytes before the end.
+	const size_t last_literals = 5;
+	const size_t match_limit = 12;
+
+	const uint8_t* in = (const uint8_t*)source;
+	uint8_t* out = (uint8_t*)dest;
+	uint8_t* const out_end = out + capacity;
+	std::vector<uint32_t> table(1 << 12, 0);
+	size_t anchor = 0;
+
+	// Write the literals since [anchor] and a match, or only the literals at the end of the block if [match_size] is 0.
+	auto sequence = [&](size_t literals, size_t offset, size_t match_size) {
+		if ((size_t)(out_end - out) < 1 + literals + literals / 255 + 1 + 2 + match_size / 255 + 1) {
+			return false;
+		}
+
+		uint8_t* token = out++;
+		size_t stored_match = (match_size) ? match_size - 4 : 0;
+
+		*token = (uint8_t)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(stored_match, 15));
+
+		if (literals >= 15)
+			out = lz_put_length(out, literals - 15);
+
+		memcpy(out, in + anchor, literals);
+		out += literals;
+
+		if (match_size) {
+			*out++ = (uint8_t)offset;
+			*out++ = (uint8_t)(offset >> 8);
+
+			if (stored_match >= 15)
+				out = lz_put_length(out, stored_match - 15);
+		}
+
+		return true;
+	};
+
+	if (size > match_limit) {
+		for (size_t i = 0; i + match_limit <= size;) {
+			uint32_t seq;
+			memcpy(&seq, in + i, 4);
+
+			uint32_t& slot = table[(seq * 2654435761u) >> 20];
+			size_t candidate = slot;
+			uint32_t found;
+
+			slot = (uint32_t)i;
+			memcpy(&found, in + candidate, 4);
+
+			if (candidate >= i || i - candidate > 65535 || found != seq) {
+				// Step faster through data that does not compress.
+				i += 1 + ((i - anchor) >> 6);
+				continue;
+			}
+
+			size_t match_size = 4;
+
+			while (i + match_size < size - last_literals && in[candidate + match_size] == in[i + match_size])
+				match_size++;
+
+			if (!sequence(i - anchor, i - candidate, match_size)) {
+				return 0;
+			}
+
+			i += match_size;
+			anchor = i;
+		}
+	}
+
+	if (!sequence(size - anchor, 0, 0)) {
+		return 0;
+	}
+
+	return out - (uint8_t*)dest;
+}
+
+// Decompress a block in the LZ4 block format, checking every length against the input and output sizes.
+size_t lz_decompress(const char* source, size_t size, char* dest, size_t capacity)
+{
+	const uint8_t* in = (const uint8_t*)source;
+	const uint8_t* const in_end = in + size;
+	uint8_t* out = (uint8_t*)dest;
+	uint8_t* const out_end = out + capacity;
+
+	auto length = [&](size_t value) {
+		if (value == 15) {
+			uint8_t b;
+
+			do {
+				if (in == in_end) {
+					return std::numeric_limits<size_t>::max();
+				}
+
+				b = *in++;
+				value += b;
+			} while (b == 255);
+		}
+
+		return value;
+	};
+
+	while (in < in_end) {
+		uint8_t token = *in++;
+		size_t literals = length(token >> 4);
+
+		if (literals > (size_t)(in_end - in) || literals > (size_t)(out_end - out)) {
+			return 0;
+		}
+
+		// Short runs are copied with one fixed size copy when there is room to copy past them.
+		if (literals <= 16 && in_end - in >= 16 && out_end - out >= 16) {
+			memcpy(out, in, 16);
+		}
+		else {
+			memcpy(out, in, literals);
+		}
+
+		in += literals;
+		out += literals;
+
+		// The last sequence has no match.
+		if (in == in_end) {
+			break;
+		}
+
+		if (in_end - in < 2) {
+			return 0;
+		}
+
+		size_t offset = in[0] | (size_t(in[1]) << 8);
+		in += 2;
+
+		size_t match_size = length(token & 15);
+
+		if (match_size == std::numeric_limits<size_t>::max()) {
+			return 0;
+		}
+
+		match_size += 4;
+
+		if (offset == 0 || offset > (size_t)(out - (uint8_t*)dest) || match_size > (size_t)(out_end - out)) {
+			return 0;
+		}
+
+		const uint8_t* match = out - offset;
+
+		// Matches are copied 8 bytes at a time when there is room to copy past them. Each 8 bytes are already written if the offset is at least 8.
+		// Closer matches repeat the last [offset] bytes, so they are copied forward byte by byte.
+		if (offset >= 8 && (size_t)(out_end - out) >= match_size + 8) {
+			for (size_t k = 0; k < match_size; k += 8)
+				memcpy(out + k, match + k, 8);
+
+			out += match_size;
+		}
+		else {
+			for (size_t k = 0; k < match_size; k++)
+				*out++ = match[k];
+		}
+	}
+
+	return out - (uint8_t*)dest;
+}
+
+// Frame layout, all integers little endian:
+// - Header: "RWZ1", codec id (u32), block size (u32).
+// - Blocks: compressed size (u32, the top bit is set if the block is stored uncompressed), size (u32), data.
+// - End marker: 0 (u32), 0 (u32).
+// - Index: offset of each block from the frame start (u64 each), block count (u64), "RWZI".
+// Streaming readers stop at the end marker, random access readers start from the index.
+const char frame_magic[4] = { 'R', 'W', 'Z', '1' };
+const char index_magic[4] = { 'R', 'W', 'Z', 'I' };
+const uint32_t stored_flag = 0x80000000u;
+const size_t frame_header_size = 12;
+const size_t block_header_size = 8;
+const size_t index_footer_size = 12;
+
+// Compress one block with its header into [dest], which has room for block_header_size + codec.bound(size) bytes.
+// Blocks that do not get smaller are stored uncompressed. Returns the size with the header.
+size_t pack_block(const Codec& codec, const char* source, size_t size, char* dest)
+{
+	size_t packed = codec.compress(source, size, dest + block_header_size, codec.bound(size));
+	uint32_t stored = 0;
+
+	if (packed == 0 || packed >= size) {
+		memcpy(dest + block_header_size, source, size);
+		packed = size;
+		stored = stored_flag;
+	}
+
+	store_le<uint32_t>(dest, (uint32_t)packed | stored);
+	store_le<uint32_t>(dest + 4, (uint32_t)size);
+	return block_header_size + packed;
+}
+
+// Write the frame header into [dest], which has room for frame_header_size bytes.
+void frame_header(const Codec& codec, size_t block_size, char* dest)
+{
+	memcpy(dest, frame_magic, 4);
+	store_le<uint32_t>(dest + 4, codec.id);
+	store_le<uint32_t>(dest + 8, (uint32_t)block_size);
+}
+
+// Get the end marker and the index of the blocks at [offsets].
+std::vector<char> frame_tail(const std::vector<uint64_t>& offsets)
+{
+	std::vector<char> tail(block_header_size + offsets.size() * 8 + index_footer_size, 0);
+	char* p = tail.data() + block_header_size;
+
+	for (uint64_t offset : offsets) {
+		store_le<uint64_t>(p, offset);
+		p += 8;
+	}
+
+	store_le<uint64_t>(p, offsets.size());
+	memcpy(p + 8, index_magic, 4);
+	return tail;
+}
+
+// Limit a block size to what fits in a block header.
+size_t clamp_block_size(size_t block_size) { return std::min<size_t>(std::max<size_t>(block_size, 1), stored_flag - 1); }
+
+// Decompress a block with the sizes from its header, returns false if it is invalid.
+bool unpack_block(const Codec& codec, uint32_t packed, uint32_t size, const char* source, char* dest)
+{
+	if (packed & stored_flag) {
+		if ((packed & ~stored_flag) != size) {
+			return false;
+		}
+
+		memcpy(dest, source, size);
+		return true;
+	}
+
+	return codec.decompress(source, packed, dest, size) == size;
+}
+
+} // namespace detail
+
+// Codec that does not compress, all blocks are stored.
+Codec stored_codec()
+{
+	return { 0, [](size_t) -> size_t { return 0; }, [](const char*, size_t, char*, size_t) -> size_t { return 0; }, [](const char*, size_t, char*, size_t) -> size_t { return 0; } };
+}
+
+// Built-in codec writing the LZ4 block format, fast to decompress with a moderate compression ratio.
+// Note: Blocks can be decompressed by the LZ4 library (LZ4_decompress_safe), and blocks of the LZ4 library by this codec.
+Codec lz_codec()
+{
+	return { 0x20345A4C, detail::lz_bound, detail::lz_compress, detail::lz_decompress }; // "LZ4 "
+}
+
+// Get a sink for CompressedWriter that appends to a write stream.
+template<typename Allocator>
+std::function<void(const char*, size_t)> stream_sink(BasicWriteStream<Allocator>& ws)
+{
+	return [&ws](const char* data, size_t size) { ws.write(data, size); };
+}
+
+// Get a sink for CompressedWriter that writes to a C file stream.
+std::function<void(const char*, size_t)> file_sink(FILE* f)
+{
+	return [f](const char* data, size_t size) { fwrite(data, 1, size, f); };
+}
+
+// Writer compressing data into a block frame, which is passed to a sink as each block is completed (see stream_sink() and file_sink()).
+// The frame is read back with CompressedView (in memory or memory mapped, blocks in any order) or compressed_source() (streaming).
+// Note: The frame is complete after finish(), which is also called by the destructor.
+struct CompressedWriter
+{
+	// Writes data to the sink.
+	using Sink = std::function<void(const char* data, size_t size)>;
+
+	// Parameters:
+	//   [block_size] The uncompressed size of each block but the last, bigger blocks compress better, smaller ones allow finer random access.
+	CompressedWriter(
+		Sink sink,
+		const Codec& codec = lz_codec(),
+		size_t block_size = 64 * 1024
+	) : sink(std::move(sink)), codec(codec) {
+		block.resize(detail::clamp_block_size(block_size));
+
+		char header[detail::frame_header_size];
+
+		detail::frame_header(codec, block.size(), header);
+		put(header, sizeof(header));
+	}
+
+	~CompressedWriter() { finish(); }
+
+	CompressedWriter(const CompressedWriter&) = delete;
+	CompressedWriter& operator=(const CompressedWriter&) = delete;
+
+	// Write a value in binary form.
+	template<typename T>
+	void write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Values are written as their bytes.");
+		write(&value, sizeof(T));
+	}
+
+	// Write [writesize] bytes from source.
+	void write(const void* source, size_t writesize)
+	{
+		const char* src = (const char*)source;
+
+		while (writesize && !finished) {
+			size_t n = std::min(writesize, block.size() - used);
+
+			memcpy(block.data() + used, src, n);
+			used += n;
+			src += n;
+			writesize -= n;
+
+			if (used == block.size())
+				flush_block();
+		}
+	}
+
+	// Write the last block, the end marker and the block index. Writes after this are ignored.
+	void finish()
+	{
+		if (finished) {
+			return;
+		}
+
+		flush_block();
+		finished = true;
+
+		std::vector<char> tail = detail::frame_tail(offsets);
+		put(tail.data(), tail.size());
+	}
+
+private:
+	Sink sink;
+	Codec codec;
+	std::vector<char> block;
+	std::vector<char> packed;
+	std::vector<uint64_t> offsets; // Of the written blocks.
+	size_t used = 0; // Bytes in [block].
+	uint64_t written = 0;
+	bool finished = false;
+
+	void put(const char* data, size_t size)
+	{
+		sink(data, size);
+		written += size;
+	}
+
+	void flush_block()
+	{
+		if (used == 0) {
+			return;
+		}
+
+		packed.resize(detail::block_header_size + std::max(codec.bound(used), used));
+		offsets.push_back(written);
+		put(packed.data(), detail::pack_block(codec, block.data(), used, packed.data()));
+		used = 0;
+	}
+};
+
+// Compress a whole buffer into a block frame, compressing the blocks on a pool of threads.
+// The frame is the same as written by CompressedWriter.
+// Parameters:
+//   [threads] The number of threads, or 0 for the number of hardware threads.
+template<typename Allocator>
+void compress(
+	const void* source,
+	size_t size,
+	BasicWriteStream<Allocator>& out,
+	const Codec& codec = lz_codec(),
+	size_t block_size = 64 * 1024,
+	unsigned threads = 0
+) {
+	block_size = detail::clamp_block_size(block_size);
+
+	const char* src = (const char*)source;
+	size_t count = (size + block_size - 1) / block_size;
+	std::vector<std::vector<char>> blocks(count);
+	std::atomic<size_t> next{ 0 };
+
+	auto run = [&]() {
+		for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+			size_t n = std::min(block_size, size - i * block_size);
+
+			blocks[i].resize(detail::block_header_size + std::max(codec.bound(n), n));
+			blocks[i].resize(detail::pack_block(codec, src + i * block_size, n, blocks[i].data()));
+		}
+	};
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<std::thread> workers;
+
+	for (size_t t = 1; t < std::min<size_t>(threads, count); t++)
+		workers.emplace_back(run);
+
+	run();
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	std::vector<uint64_t> offsets(count);
+	uint64_t offset = detail::frame_header_size;
+
+	for (size_t i = 0; i < count; i++) {
+		offsets[i] = offset;
+		offset += blocks[i].size();
+	}
+
+	std::vector<char> tail = detail::frame_tail(offsets);
+	char header[detail::frame_header_size];
+
+	detail::frame_header(codec, block_size, header);
+	out.grow(out.pos + (size_t)offset + tail.size());
+	out.write(header, sizeof(header));
+
+	for (const std::vector<char>& block : blocks)
+		out.write(block.data(), block.size());
+
+	out.write(tail.data(), tail.size());
+}
+
+// Random access reader of a block frame in memory, such as a MappedFile.
+// Blocks are decompressed independently, so any part of the data can be read without decompressing what is before it.
+// Note: The data of the stream must stay alive and unmodified while the view is in use.
+struct CompressedView
+{
+	CompressedView(ReadStream rs, const Codec& codec = lz_codec()) : codec(codec) { open(rs); }
+
+	// Check if the frame is valid and uses the codec of the view.
+	operator bool() const { return data != nullptr; }
+
+	// Get the size of the decompressed data.
+	uint64_t size() const { return total; }
+
+	size_t block_count() const { return count; }
+
+	// Get the uncompressed size of the blocks but the last.
+	size_t block_size() const { return block; }
+
+	// Decompress block [i] into [dest], which has room for block_size() bytes.
+	// Returns the size of the block, or 0 if it is invalid.
+	size_t read_block(size_t i, void* dest) const
+	{
+		const char* p = block_at(i);
+
+		if (!p) {
+			return 0;
+		}
+
+		uint32_t packed = detail::load_le<uint32_t>(p);
+		uint32_t raw = detail::load_le<uint32_t>(p + 4);
+
+		if (raw > block || (packed & ~detail::stored_flag) > (size_t)(index - p - detail::block_header_size)) {
+			return 0;
+		}
+
+		return (detail::unpack_block(codec, packed, raw, p + detail::block_header_size, (char*)dest)) ? raw : 0;
+	}
+
+	// Read up to [readsize] bytes of the decompressed data from [offset] into destination, returns the number of bytes read.
+	size_t read(uint64_t offset, void* destination, size_t readsize) const
+	{
+		char* dest = (char*)destination;
+		size_t done = 0;
+		std::vector<char> buf;
+
+		while (done < readsize && offset + done < total) {
+			size_t i = (size_t)((offset + done) / block);
+			size_t skip = (size_t)((offset + done) % block);
+			size_t n = std::min<uint64_t>(readsize - done, std::min<uint64_t>(block - skip, total - offset - done));
+
+			// Whole blocks are decompressed in place.
+			if (skip == 0 && n == block) {
+				if (read_block(i, dest + done) != block) {
+					break;
+				}
+			}
+			else {
+				buf.resize(block);
+
+				if (read_block(i, buf.data()) < skip + n) {
+					break;
+				}
+
+				memcpy(dest + done, buf.data() + skip, n);
+			}
+
+			done += n;
+		}
+
+		return done;
+	}
+
+	// Decompress all data, with the blocks spread over a pool of threads.
+	// Returns an empty string if a block is invalid.
+	// Parameters:
+	//   [threads] The number of threads, or 0 for the number of hardware threads.
+	std::string decompress(unsigned threads = 0) const
+	{
+		std::string str((size_t)total, '\0');
+		std::atomic<size_t> next{ 0 };
+		std::atomic<bool> failed{ false };
+
+		auto run = [&]() {
+			for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+				size_t expected = (size_t)std::min<uint64_t>(block, total - (uint64_t)i * block);
+
+				if (read_block(i, str.data() + (size_t)i * block) != expected)
+					failed = true;
+			}
+		};
+
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<std::thread> workers;
+
+		for (size_t t = 1; t < std::min<size_t>(threads, count); t++)
+			workers.emplace_back(run);
+
+		run();
+
+		for (std::thread& worker : workers)
+			worker.join();
+
+		return (failed) ? std::string() : str;
+	}
+
+private:
+	Codec codec;
+	const char* data = nullptr;
+	const char* index = nullptr;
+	size_t count = 0;
+	size_t block = 0;
+	uint64_t total = 0;
+
+	const char* block_at(size_t i) const
+	{
+		if (i >= count) {
+			return nullptr;
+		}
+
+		uint64_t offset = detail::load_le<uint64_t>(index + i * 8);
+
+		return (offset >= detail::frame_header_size && offset + detail::block_header_size <= (uint64_t)(index - data)) ? data + offset : nullptr;
+	}
+
+	void open(ReadStream rs)
+	{
+		const char* begin = rs.data + std::min(rs.pos, rs.size);
+		size_t len = rs.size - std::min(rs.pos, rs.size);
+
+		if (len < detail::frame_header_size + detail::block_header_size + detail::index_footer_size || memcmp(begin, detail::frame_magic, 4) != 0
+			|| detail::load_le<uint32_t>(begin + 4) != codec.id || memcmp(begin + len - 4, detail::index_magic, 4) != 0) {
+			return;
+		}
+
+		uint64_t blocks = detail::load_le<uint64_t>(begin + len - detail::index_footer_size);
+		size_t room = len - detail::frame_header_size - detail::block_header_size - detail::index_footer_size;
+
+		block = detail::load_le<uint32_t>(begin + 8);
+
+		if (block == 0 || blocks > room / 8) {
+			return;
+		}
+
+		data = begin;
+		count = (size_t)blocks;
+		index = begin + len - detail::index_footer_size - count * 8;
+
+		// All blocks but the last are full.
+		if (count) {
+			const char* last = block_at(count - 1);
+			uint32_t raw = (last) ? detail::load_le<uint32_t>(last + 4) : 0;
+
+			if (raw == 0 || raw > block) {
+				data = nullptr;
+				return;
+			}
+
+			total = (uint64_t)(count - 1) * block + raw;
+		}
+	}
+};
+
+// Get a refill function for StreamReader that decompresses a block frame read from [source], for frames that are not in memory as a whole.
+// Only one block is buffered at a time. The data ends early if the frame is invalid or was not written with [codec].
+StreamReader::Refill compressed_source(StreamReader::Refill source, const Codec& codec = lz_codec())
+{
+	struct State
+	{
+		State(StreamReader::Refill source, const Codec& codec) : in(std::move(source)), codec(codec) {}
+
+		StreamReader in;
+		Codec codec;
+		std::vector<char> packed;
+		std::vector<char> block;
+		size_t begin = 0;
+		size_t end = 0;
+		bool started = false;
+		bool done = false;
+	};
+
+	std::shared_ptr<State> state = std::make_shared<State>(std::move(source), codec);
+
+	return [state](char* dest, size_t size) -> size_t {
+		State& s = *state;
+
+		if (!s.started) {
+			char header[detail::frame_header_size];
+
+			s.started = true;
+			s.done = s.in.read(header, sizeof(header)) != sizeof(header) || memcmp(header, detail::frame_magic, 4) != 0
+				|| detail::load_le<uint32_t>(header + 4) != s.codec.id || detail::load_le<uint32_t>(header + 8) == 0;
+
+			if (!s.done)
+				s.block.resize(detail::load_le<uint32_t>(header + 8));
+		}
+
+		while (s.begin == s.end && !s.done) {
+			char header[detail::block_header_size];
+
+			if (s.in.read(header, sizeof(header)) != sizeof(header)) {
+				s.done = true;
+				break;
+			}
+
+			uint32_t packed = detail::load_le<uint32_t>(header);
+			uint32_t raw = detail::load_le<uint32_t>(header + 4);
+			size_t packed_size = packed & ~detail::stored_flag;
+
+			// The end marker, or a block that cannot be valid.
+			if (raw == 0 || raw > s.block.size() || packed_size > std::max(s.codec.bound(s.block.size()), s.block.size())) {
+				s.done = true;
+				break;
+			}
+
+			s.packed.resize(packed_size);
+
+			if (s.in.read(s.packed.data(), packed_size) != packed_size || !detail::unpack_block(s.codec, packed, raw, s.packed.data(), s.block.data())) {
+				s.done = true;
+				break;
+			}
+
+			s.begin = 0;
+			s.end = raw;
+		}
+
+		size_t n = std::min(size, s.end - s.begin);
+
+		if (n)
+			memcpy(dest, s.block.data() + s.begin, n);
+
+		s.begin += n;
+		return n;
+	};
+}
+
+} // |===|   END namespace rw   |===|
+
+
+
+namespace stn
+{
+
+// Attribute table returned by parse_view().
+// The entries are sorted by attribute name and unique, so lookups are binary searches over contiguous memory.
+// Names and values are views into the parsed buffer, see parse_view() for their lifetime.
+template<typename Allocator = std::allocator<std::pair<std::string_view, std::string_view>>>
+struct BasicAttributeTable
+{
+	using value_type = std::pair<std::string_view, std::string_view>;
+	using const_iterator = typename std::vector<value_type, Allocator>::const_iterator;
+
+	std::vector<value_type, Allocator> entries;
+
+	BasicAttributeTable() = default;
+	explicit BasicAttributeTable(const Allocator& alloc) : entries(alloc) {}
+
+	// Find the value of an attribute.
+	// Returns nullptr if there is no such attribute.
+	const std::string_view* find(std::string_view key) const
+	{
+		auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const value_type& e, std::string_view k) { return e.first < k; });
+		return (it != entries.end() && it->first == key) ? &it->second : nullptr;
+	}
+
+	// Get the value of an attribute, or an empty view if there is no such attribute.
+	std::string_view operator[](std::string_view key) const
+	{
+		const std::string_view* val = find(key);
+		return (val) ? *val : std::string_view();
+	}
+
+	size_t count(std::string_view key) const { return find(key) != nullptr; }
+
+	size_t size() const { return entries.size(); }
+	bool empty() const { return entries.empty(); }
+
+	const_iterator begin() const { return entries.begin(); }
+	const_iterator end() const { return entries.end(); }
+
+	// Sort entries appended in file order by attribute name.
+	// Of duplicate attributes only the most recent occurence is kept.
+	void sort_unique()
+	{
+		std::stable_sort(entries.begin(), entries.end(), [](const value_type& a, const value_type& b) { return a.first < b.first; });
+
+		size_t kept = 0;
+
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (i + 1 < entries.size() && entries[i + 1].first == entries[i].first) {
+				continue;
+			}
+
+			entries[kept++] = entries[i];
+		}
+
+		entries.resize(kept);
+	}
+};
+
+using AttributeTable = BasicAttributeTable<>;
+
+namespace detail
+{
+
+const std::string_view multiline_begin = "[MULTILINE]";
+const std::string_view multiline_end = "\n[END_MULTILINE]\n";
+
+// Parse the attribute-value pairs on the lines starting before [end], calling [emit](name, value) in file order.
+// Names and values are views into the data of [rs].
+// [key] holds an attribute name that is still waiting for its value, so parsing can be resumed by another call.
+// Note: The read position pointer ends up past [end] if a multiline value runs over it.
+template<typename Emit>
+void parse_lines(rw::ReadStream& rs, size_t end, std::string_view& key, Emit&& emit)
+{
+	while (rs.pos < end && rs) {
+		std::string_view line = rs.readLine();
+
+		RW_COUNT(parse_lines, 1);
+
+		if (line.empty() || line[0] == '#') {
+			if (!key.empty()) {
+				RW_COUNT(parse_keys, 1);
+				emit(key, line);
+				key = {};
+			}
+			continue;
+		}
+
+		if (key.empty()) {
+			key = line;
+		}
+		else {
+			if (line == multiline_begin) {
+				size_t term = rs.find(multiline_end);
+
+				RW_COUNT(parse_multiline, 1);
+				line = std::string_view(rs.data + rs.pos, term - rs.pos);
+				rs.pos = std::min(rs.size, term + multiline_end.size());
+			}
+
+			RW_COUNT(parse_keys, 1);
+			emit(key, line);
+			key = {};
+		}
+	}
+}
+
+// Parse the attributes of [rs] into a map, names and values are allocated with the allocator of the map.
+template<typename Map>
+void parse_into(rw::ReadStream rs, Map& attrs)
+{
+	std::string_view key;
+
+	parse_lines(rs, rs.size, key, [&](std::string_view name, std::string_view val) {
+		attrs[typename Map::key_type(name, attrs.get_allocator())].assign(val);
+	});
+}
+
+// Parse the attributes of [rs] into a table of views.
+template<typename Allocator>
+void parse_into(rw::ReadStream rs, BasicAttributeTable<Allocator>& attrs)
+{
+	std::string_view key;
+
+	parse_lines(rs, rs.size, key, [&](std::string_view name, std::string_view val) {
+		attrs.entries.emplace_back(name, val);
+	});
+
+	attrs.sort_unique();
+}
+
+// Call [parse] with a stream over the contents of a file and return its result.
+// Note: On Windows the file is read in text mode so that CRLF line endings are translated, elsewhere it is parsed straight from a memory mapping.
+template<typename Parse>
+auto parse_file(const char* filename, Parse&& parse)
+{
+#if !defined(_WIN32)
+	rw::MappedFile file(filename);
+
+	if (file) {
+		return parse(file.stream());
+	}
+#endif
+
+	std::string str = rw::readfile(filename);
+	return parse(rw::ReadStream(str.data(), str.size()));
+}
+
+} // namespace detail
+
+// Parse simple text (.txt) notation files in memory.
+std::map<std::string, std::string> parse(rw::ReadStream rs)
+{
+	std::map<std::string, std::string> attrs;
+	detail::parse_into(rs, attrs);
+	return attrs;
+}
+
+// Parse simple text (.txt) notation files in memory without copying attribute names and values.
+// The returned table refers to the data of [rs], which must stay alive and unmodified for as long as the table is in use.
+AttributeTable parse_view(rw::ReadStream rs)
+{
+	AttributeTable attrs;
+	detail::parse_into(rs, attrs);
+	return attrs;
+}
+
+// Parse simple text (.txt) notation files.
+std::map<std::string, std::string> parse(const char* filename)
+{
+	return detail::parse_file(filename, [](rw::ReadStream rs) { return parse(rs); });
+}
+
+namespace detail
+{
+
+// Check if a value has to be written as a multiline block, because it has a newline or would be read as the start of a block.
+bool needs_multiline(std::string_view value)
+{
+	return value == multiline_begin || memchr(value.data(), '\n', value.size()) != nullptr;
+}
+
+// Check if a multiline block would end right after [value], and not at a terminator inside it or overlapping its end.
+bool fits_multiline(std::string_view value)
+{
+	if (rw::find_sequence(value.data(), value.size(), multiline_end.data(), multiline_end.size()) != value.size()) {
+		return false;
+	}
+
+	// The end of the value followed by the terminator, the terminator is 17 bytes long.
+	char tail[64];
+	size_t keep = std::min(value.size(), multiline_end.size() - 1);
+
+	memcpy(tail, value.data() + value.size() - keep, keep);
+	memcpy(tail + keep, multiline_end.data(), multiline_end.size());
+	return rw::find_sequence(tail, keep + multiline_end.size(), multiline_end.data(), multiline_end.size()) == keep;
+}
+
+// Get the text size of an attribute, or 0 if it cannot be written so that it parses back the same.
+// Names must not be empty, start with '#' or contain a newline.
+size_t entry_size(std::string_view name, std::string_view value)
+{
+	if (name.empty() || name[0] == '#' || memchr(name.data(), '\n', name.size())) {
+		return 0;
+	}
+
+	if (!needs_multiline(value)) {
+		return name.size() + 1 + value.size() + 1;
+	}
+
+	if (!fits_multiline(value)) {
+		return 0;
+	}
+
+	return name.size() + 1 + multiline_begin.size() + 1 + value.size() + multiline_end.size();
+}
+
+char* put_text(char* out, std::string_view str)
+{
+	memcpy(out, str.data(), str.size());
+	return out + str.size();
+}
+
+} // namespace detail
+
+// Write attributes in simple text notation, so that parse() reads them back exactly.
+// Values with newlines are written as [MULTILINE] blocks. The text is sized first and written into a single prepared block of [ws].
+// <Attrs> is any range of name-value pairs convertible to std::string_view, such as the results of parse() and parse_view().
+// Returns: False without writing anything if an attribute cannot be written: a name is empty, starts with '#' or has a newline, or a multiline value contains the block terminator.
+template<typename Attrs, typename Allocator>
+bool write(
+	const Attrs& attrs,
+	rw::BasicWriteStream<Allocator>& ws
+) {
+	size_t total = 0;
+
+	for (const auto& [name, value] : attrs) {
+		size_t size = detail::entry_size(name, value);
+
+		if (!size) {
+			return false;
+		}
+
+		total += size;
+	}
+
+	char* begin = (char*)ws.prepare(total);
+	char* out = begin;
+
+	for (const auto& [name, value] : attrs) {
+		std::string_view val(value);
+
+		out = detail::put_text(out, name);
+		*out++ = '\n';
+
+		if (detail::needs_multiline(val)) {
+			out = detail::put_text(out, detail::multiline_begin);
+			*out++ = '\n';
+			out = detail::put_text(out, val);
+			out = detail::put_text(out, detail::multiline_end);
+		}
+		else {
+			out = detail::put_text(out, val);
+			*out++ = '\n';
+		}
+	}
+
+	ws.commit(out - begin);
+	return true;
+}
+
+// Write attributes to a file in simple text notation with a single write, see write(attrs, ws).
+// Returns: False if an attribute cannot be written, or the file cannot be written.
+template<typename Attrs>
+bool write(
+	const char* filename,
+	const Attrs& attrs
+) {
+	rw::WriteStream ws;
+
+	if (!write(attrs, ws)) {
+		return false;
+	}
+
+	rw::File f(filename, rw::File::writable | rw::File::create | rw::File::truncate);
+	return f && f.pwrite(ws.data(), ws.size(), 0) == ws.size();
+}
+
+namespace detail
+{
+
+// Attributes parsed from one chunk of a buffer by parse_chunks().
+template<typename Attrs>
+struct Chunk
+{
+	Attrs attrs;
+	size_t begin = 0; // Position of the first line of the chunk.
+	size_t end = 0; // Position after the last line of the chunk.
+	size_t stop = 0; // Position where parsing stopped.
+	std::string_view key; // Attribute name still waiting for its value at [stop].
+};
+
+// Get the position of the first line at or after [from] that follows an empty line, or the size of [rs] if there is none.
+// A new attribute always starts there, unless a multiline value runs over it.
+size_t next_record_start(const rw::ReadStream& rs, size_t from)
+{
+	if (from >= rs.size) {
+		return rs.size;
+	}
+
+	size_t found = from + rw::find_sequence(rs.data + from, rs.size - from, "\n\n", 2);
+	return std::min(rs.size, found + 2);
+}
+
+// Split [rs] into chunks after empty lines and call [parse](stream, end, key, attrs) for each chunk on its own thread.
+// Each chunk is first parsed assuming it starts with a new attribute. A chunk whose start was not where the previous chunk stopped
+// (a multiline value ran over the split point) is parsed again sequentially from there, so the result is always the same as parsing in one go.
+template<typename Attrs, typename Parse>
+std::vector<Chunk<Attrs>> parse_chunks(rw::ReadStream rs, unsigned threads, Parse&& parse)
+{
+	const size_t min_chunk_size = 64 * 1024;
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	size_t count = std::max<size_t>(1, std::min<size_t>(threads, rs.size / min_chunk_size));
+	std::vector<Chunk<Attrs>> chunks(count);
+
+	for (size_t i = 0; i < count; i++) {
+		chunks[i].begin = (i == 0) ? 0 : std::max(chunks[i - 1].begin, next_record_start(rs, rs.size / count * i));
+
+		if (i > 0)
+			chunks[i - 1].end = chunks[i].begin;
+	}
+
+	chunks.back().end = rs.size;
+
+	auto run = [&](Chunk<Attrs>& chunk, size_t from) {
+		rw::ReadStream chunk_rs = rs;
+
+		chunk_rs.pos = from;
+		parse(chunk_rs, chunk.end, chunk.key, chunk.attrs);
+		chunk.stop = std::max(chunk_rs.pos, from);
+	};
+
+	std::vector<std::thread> workers;
+
+	for (size_t i = 1; i < count; i++)
+		workers.emplace_back([&, i]() { run(chunks[i], chunks[i].begin); });
+
+	run(chunks[0], 0);
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	for (size_t i = 1; i < count; i++) {
+		const Chunk<Attrs>& prev = chunks[i - 1];
+		Chunk<Attrs>& chunk = chunks[i];
+
+		if (prev.stop != chunk.begin || !prev.key.empty()) {
+			chunk.attrs = Attrs();
+			chunk.key = prev.key;
+			run(chunk, prev.stop);
+		}
+	}
+
+	return chunks;
+}
+
+// Merge two attribute tables sorted by name, the attributes of [later] replace those of [earlier] with the same name.
+AttributeTable merge_tables(const AttributeTable& earlier, const AttributeTable& later)
+{
+	AttributeTable merged;
+	auto a = earlier.begin(), b = later.begin();
+
+	merged.entries.reserve(earlier.size() + later.size());
+
+	while (a != earlier.end() && b != later.end()) {
+		if (a->first < b->first) {
+			merged.entries.push_back(*a++);
+		}
+		else {
+			if (a->first == b->first)
+				a++;
+
+			merged.entries.push_back(*b++);
+		}
+	}
+
+	merged.entries.insert(merged.entries.end(), a, earlier.end());
+	merged.entries.insert(merged.entries.end(), b, later.end());
+	return merged;
+}
+
+} // namespace detail
+
+// Parse simple text (.txt) notation files in memory on multiple threads.
+// The data is split into chunks after empty lines, which are parsed in parallel and merged. The result is the same as parse().
+// Parameters:
+//   [threads] The number of threads to use, if 0 use std::thread::hardware_concurrency(). Small inputs use fewer threads.
+std::map<std::string, std::string> parse_parallel(rw::ReadStream rs, unsigned threads = 0)
+{
+	using Attrs = std::map<std::string, std::string>;
+
+	std::vector<detail::Chunk<Attrs>> chunks = detail::parse_chunks<Attrs>(rs, threads,
+		[](rw::ReadStream& chunk_rs, size_t end, std::string_view& key, Attrs& attrs) {
+			detail::parse_lines(chunk_rs, end, key, [&](std::string_view name, std::string_view val) {
+				attrs[std::string(name)].assign(val);
+			});
+		}
+	);
+
+	// Merging from the last chunk keeps the most recent occurence of duplicate attributes, map::merge() skips names already present.
+	Attrs attrs = std::move(chunks.back().attrs);
+
+	for (size_t i = chunks.size() - 1; i-- > 0;)
+		attrs.merge(chunks[i].attrs);
+
+	return attrs;
+}
+
+// Parse simple text (.txt) notation files in memory on multiple threads without copying attribute names and values.
+// See parse_parallel() and parse_view().
+AttributeTable parse_view_parallel(rw::ReadStream rs, unsigned threads = 0)
+{
+	std::vector<detail::Chunk<AttributeTable>> chunks = detail::parse_chunks<AttributeTable>(rs, threads,
+		[](rw::ReadStream& chunk_rs, size_t end, std::string_view& key, AttributeTable& attrs) {
+			detail::parse_lines(chunk_rs, end, key, [&](std::string_view name, std::string_view val) {
+				attrs.entries.emplace_back(name, val);
+			});
+
+			attrs.sort_unique();
+		}
+	);
+
+	// Merge neighbouring chunks pairwise so every entry is copied log2(chunks) times.
+	for (size_t step = 1; step < chunks.size(); step *= 2) {
+		for (size_t i = 0; i + step < chunks.size(); i += step * 2)
+			chunks[i].attrs = detail::merge_tables(chunks[i].attrs, chunks[i + step].attrs);
+	}
+
+	return std::move(chunks[0].attrs);
+}
+
+// Parse simple text (.txt) notation files on multiple threads, see parse_parallel().
+std::map<std::string, std::string> parse_parallel(const char* filename, unsigned threads = 0)
+{
+	return detail::parse_file(filename, [&](rw::ReadStream rs) { return parse_parallel(rs, threads); });
+}
+
+// Parse many simple text (.txt) notation files on a pool of threads, see rw::read_batch().
+// Each file is parsed by the thread that read it, right after reading it.
+// Parameters:
+//   [on_parsed] If set, called with the index of each path and its attributes as soon as the file is parsed, on the thread that parsed it.
+//   Calls from different threads can run at the same time.
+//   [threads] The number of threads, or 0 for the number of hardware threads.
+// Returns: The attributes of each file, in the order of the paths. Files that cannot be read have no attributes.
+// Note: Files are read in binary mode, carriage returns of CRLF line breaks are kept on all platforms.
+std::vector<std::map<std::string, std::string>> parse_batch(
+	const std::vector<std::string>& paths,
+	const std::function<void(size_t index, std::map<std::string, std::string>& attrs)>& on_parsed = {},
+	unsigned threads = 0
+) {
+	std::vector<std::map<std::string, std::string>> results(paths.size());
+
+	rw::read_batch(paths, [&](size_t i, const rw::FileBatch::Entry& file) {
+		results[i] = parse(file.stream());
+
+		if (on_parsed) {
+			on_parsed(i, results[i]);
+		}
+	}, threads);
+
+	return results;
+}
+
+// Parse many files like parse_batch(), without copying attribute names and values.
+// The tables refer to the file data in [files], which must stay alive for as long as the tables are in use.
+std::vector<AttributeTable> parse_view_batch(
+	const std::vector<std::string>& paths,
+	rw::FileBatch& files,
+	unsigned threads = 0
+) {
+	std::vector<AttributeTable> results(paths.size());
+
+	files = rw::read_batch(paths, [&](size_t i, const rw::FileBatch::Entry& file) { results[i] = parse_view(file.stream()); }, threads);
+	return results;
+}
+
+// Parse simple text (.txt) notation from a stream reader, for sources that are not in memory as a whole.
+// Only the current line (or multiline value) is buffered at a time.
+std::map<std::string, std::string> parse(rw::StreamReader& sr)
+{
+	std::map<std::string, std::string> attrs;
+	std::string key;
+
+	while (sr) {
+		std::string_view line = sr.readLine();
+
+		RW_COUNT(parse_lines, 1);
+
+		if (line.empty() || line[0] == '#') {
+			if (!key.empty()) {
+				RW_COUNT(parse_keys, 1);
+				attrs[key].assign(line);
+				key.clear();
+			}
+			continue;
+		}
+
+		if (key.empty()) {
+			key.assign(line);
+		}
+		else {
+			if (line == detail::multiline_begin) {
+				RW_COUNT(parse_multiline, 1);
+				attrs[key] = sr.readUntil(sr.find(detail::multiline_end));
+				sr.skip(detail::multiline_end.size());
+			}
+			else {
+				attrs[key].assign(line);
+			}
+
+			RW_COUNT(parse_keys, 1);
+			key.clear();
+		}
+	}
+
+	return attrs;
+}
+
+// Attribute lookups in simple text notation data without parsing all of it, for when only a few attributes of a large file are needed.
+// A lookup searches the data for lines equal to the name (with SIMD, see rw::find_sequence()), and checks that a line is an attribute name
+// by counting the lines back to the previous empty or comment line, after which the parser is always between attributes.
+// Only the values that are asked for are resolved, and the most recent occurence of an attribute wins like with parse().
+// Data with multiline values, or with very long runs of lines without an empty line, is parsed once into an index on the first lookup instead.
+// Each lookup of a new name scans all of the data, also when the name is missing (results, and misses, are cached per name).
+// After lookups have scanned the data 4 times over, it is parsed into the index too, as further lookups are then cheaper that way.
+// Note: The data of the stream must stay alive and unmodified while the document is in use.
+// Note: Lookups update internal caches, a document must not be used by several threads at once.
+struct LazyDocument
+{
+	LazyDocument(rw::ReadStream rs) : rs(rs) {}
+	LazyDocument(const rw::MappedFile& file) : rs(file.stream()) {}
+
+	// Find the value of an attribute.
+	// Returns nullptr if there is no such attribute.
+	const std::string_view* find(std::string_view key)
+	{
+		auto it = resolved.find(key);
+
+		if (it == resolved.end())
+			it = resolved.emplace(std::string(key), resolve(key)).first;
+
+		return (it->second) ? &*it->second : nullptr;
+	}
+
+	// Get the value of an attribute, or an empty view if there is no such attribute.
+	std::string_view operator[](std::string_view key)
+	{
+		const std::string_view* val = find(key);
+		return (val) ? *val : std::string_view();
+	}
+
+	size_t count(std::string_view key) { return find(key) != nullptr; }
+
+	// Check if the whole data was parsed into an index.
+	bool indexed() const { return has_index; }
+
+private:
+	rw::ReadStream rs;
+	std::map<std::string, std::optional<std::string_view>, std::less<>> resolved; // Values that were asked for, or nothing if not found.
+	AttributeTable index;
+	bool has_index = false;
+	bool checked = false;
+	size_t scans = 0; // Number of lookups that scanned the data.
+
+	// Longest distance to walk back from a found line to the previous empty or comment line.
+	static constexpr size_t max_walk = 64 * 1024;
+
+	// Number of scans of the data after which it is indexed.
+	static constexpr size_t max_scans = 4;
+
+	void build_index()
+	{
+		index = parse_view(rs);
+		has_index = true;
+	}
+
+	std::optional<std::string_view> resolve(std::string_view key)
+	{
+		// Empty and comment lines are never attribute names, and names are single lines.
+		if (key.empty() || key[0] == '#' || key.find('\n') != std::string_view::npos) {
+			return {};
+		}
+
+		const char* begin = rs.data + std::min(rs.pos, rs.size);
+		const size_t size = rs.size - std::min(rs.pos, rs.size);
+
+		if (!checked) {
+			checked = true;
+
+			if (rw::find_sequence(begin, size, detail::multiline_begin.data(), detail::multiline_begin.size()) < size)
+				build_index();
+		}
+
+		if (!has_index && ++scans > max_scans)
+			build_index();
+
+		if (has_index) {
+			const std::string_view* val = index.find(key);
+			return (val) ? std::optional<std::string_view>(*val) : std::nullopt;
+		}
+
+		std::optional<std::string_view> found;
+
+		for (size_t at = 0; at + key.size() <= size; at++) {
+			at += rw::find_sequence(begin + at, size - at, key.data(), key.size());
+
+			if (at >= size) {
+				break;
+			}
+
+			size_t line_end = at + key.size();
+
+			// The value is the next line, an attribute name on the last line has none.
+			if ((at && begin[at - 1] != '\n') || line_end + 1 >= size || begin[line_end] != '\n') {
+				continue;
+			}
+
+			// Lines since the previous empty or comment line are names and values in turns, starting with a name.
+			size_t lines = 0;
+			size_t line = at;
+
+			while (line) {
+				size_t prev = line - 1;
+
+				while (prev && begin[prev - 1] != '\n')
+					prev--;
+
+				if (prev + 1 == line || begin[prev] == '#') {
+					break;
+				}
+
+				if (at - prev > max_walk) {
+					build_index();
+					return resolve(key);
+				}
+
+				lines++;
+				line = prev;
+			}
+
+			if (lines % 2 == 0) {
+				const char* value = begin + line_end + 1;
+				const char* value_end = (const char*)memchr(value, '\n', begin + size - value);
+
+				found = std::string_view(value, (value_end) ? value_end - value : begin + size - value);
+			}
+		}
+
+		return found;
+	}
+};
+
+namespace detail
+{
+
+// Remove spaces, tabs and carriage returns (of files with CRLF line breaks) around a value.
+std::string_view trim_value(std::string_view str)
+{
+	size_t begin = str.find_first_not_of(" \t\r");
+
+	if (begin == std::string_view::npos) {
+		return {};
+	}
+
+	return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+// Check if [str] equals [lower] ignoring the case of ASCII letters, [lower] must be in lower case.
+bool equals_lower(std::string_view str, std::string_view lower)
+{
+	if (str.size() != lower.size()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = (str[i] >= 'A' && str[i] <= 'Z') ? char(str[i] - 'A' + 'a') : str[i];
+
+		if (c != lower[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace detail
+
+// Convert an attribute value to a number or a bool.
+// Numbers are parsed with std::from_chars, so they are not affected by the locale. A leading '+' and spaces around the number are allowed.
+// Bools are "true", "yes", "on" and "1", or "false", "no", "off" and "0", in any case.
+// Returns false, leaving [value] unchanged, if [str] is not a valid value of type <T> or is out of its range.
+// Note: Without floating point support in std::from_chars, floating point numbers are parsed with strtold, which uses the C locale set by the program.
+template<typename T>
+bool convert(std::string_view str, T& value)
+{
+	static_assert(std::is_arithmetic_v<T>, "Values can only be converted to numbers and bools.");
+
+	str = detail::trim_value(str);
+
+	if constexpr (std::is_same_v<T, bool>) {
+		for (std::string_view word : { "true", "yes", "on", "1" }) {
+			if (detail::equals_lower(str, word)) {
+				value = true;
+				return true;
+			}
+		}
+
+		for (std::string_view word : { "false", "no", "off", "0" }) {
+			if (detail::equals_lower(str, word)) {
+				value = false;
+				return true;
+			}
+		}
+
+		return false;
+	}
+	else {
+		// from_chars does not accept a '+' sign, "+-1" has to stay invalid.
+		if (str.size() > 1 && str[0] == '+' && str[1] != '-')
+			str.remove_prefix(1);
+
+		const char* end = str.data() + str.size();
+		T t{};
+
+#if !defined(__cpp_lib_to_chars)
+		if constexpr (std::is_floating_point_v<T>) {
+			char buf[128];
+
+			if (str.empty() || str.size() >= sizeof(buf)) {
+				return false;
+			}
+
+			memcpy(buf, str.data(), str.size());
+			buf[str.size()] = '\0';
+
+			char* parsed;
+			errno = 0;
+			long double ld = strtold(buf, &parsed);
+
+			if (parsed != buf + str.size() || errno == ERANGE || ld > std::numeric_limits<T>::max() || ld < -std::numeric_limits<T>::max()) {
+				return false;
+			}
+
+			value = (T)ld;
+			return true;
+		}
+		else
+#endif
+		{
+			std::from_chars_result result = std::from_chars(str.data(), end, t);
+
+			if (result.ec != std::errc() || result.ptr != end || str.empty()) {
+				return false;
+			}
+		}
+
+		value = t;
+		return true;
+	}
+}
+
+// Convert a list of values separated by [separator] (see convert()), such as "1, 2.5, 3".
+// An empty string is an empty list.
+// Returns false if any of the values is not valid, [values] then holds the values before it.
+template<typename T>
+bool convert_list(std::string_view str, std::vector<T>& values, char separator = ',')
+{
+	values.clear();
+
+	if (detail::trim_value(str).empty()) {
+		return true;
+	}
+
+	for (;;) {
+		size_t next = str.find(separator);
+		T t{};
+
+		if (!convert(str.substr(0, next), t)) {
+			return false;
+		}
+
+		values.push_back(t);
+
+		if (next == std::string_view::npos) {
+			return true;
+		}
+
+		str.remove_prefix(next + 1);
+	}
+}
+
+namespace detail
+{
+
+template<typename C, typename = void>
+struct is_transparent : std::false_type {};
+
+template<typename C>
+struct is_transparent<C, std::void_t<typename C::is_transparent>> : std::true_type {};
+
+// Maps with a transparent comparator (std::less<>, like pmr::Attributes) are searched with the view itself.
+// Other maps, like the ones parse() returns, get the name copied into a buffer that is reused, so lookups do not allocate once it is big enough.
+template<typename K, typename V, typename C, typename A>
+std::optional<std::string_view> find_value(const std::map<K, V, C, A>& attrs, std::string_view key)
+{
+	if constexpr (is_transparent<C>::value) {
+		auto it = attrs.find(key);
+		return (it != attrs.end()) ? std::optional<std::string_view>(it->second) : std::nullopt;
+	}
+	else {
+		thread_local K name;
+
+		name.assign(key.data(), key.size());
+
+		auto it = attrs.find(name);
+		return (it != attrs.end()) ? std::optional<std::string_view>(it->second) : std::nullopt;
+	}
+}
+
+// Tables and documents with a find(key) function returning a pointer to the value.
+template<typename Attrs, typename = std::enable_if_t<std::is_pointer_v<decltype(std::declval<Attrs&>().find(std::string_view()))>>>
+std::optional<std::string_view> find_value(Attrs& attrs, std::string_view key)
+{
+	auto* val = attrs.find(key);
+	return (val) ? std::optional<std::string_view>(*val) : std::nullopt;
+}
+
+} // namespace detail
+
+// Get an attribute converted to type <T> (see convert()), or [fallback] if there is no such attribute or its value is not a valid <T>.
+// [attrs] is a map returned by parse(), an AttributeTable or a LazyDocument.
+// Note: The value is converted again on every call, use TypedTable for attributes that are read often.
+template<typename T, typename Attrs>
+T get(Attrs& attrs, std::string_view key, T fallback = T())
+{
+	std::optional<std::string_view> str = detail::find_value(attrs, key);
+	T value = fallback;
+
+	if (str)
+		convert(*str, value);
+
+	return value;
+}
+
+// Get an attribute as a list of values (see convert_list()).
+// Returns false if there is no such attribute or its value is not a valid list.
+template<typename T, typename Attrs>
+bool get_list(Attrs& attrs, std::string_view key, std::vector<T>& values, char separator = ',')
+{
+	std::optional<std::string_view> str = detail::find_value(attrs, key);
+
+	if (!str) {
+		values.clear();
+		return false;
+	}
+
+	return convert_list(*str, values, separator);
+}
+
+// Attribute table that converts a value to a number or a bool on first access and keeps the result for the next accesses.
+// Attributes can also be looked up once with index(), and then read by index without searching for the name.
+// Note: Reads update the cache, a table must not be read by several threads at once.
+struct TypedTable
+{
+	AttributeTable table; // Must not be changed, the cache has an entry for each attribute.
+
+	TypedTable() = default;
+	TypedTable(AttributeTable table) : table(std::move(table)), cache(this->table.size()) {}
+
+	// Get the index of an attribute, or size() if there is no such attribute.
+	size_t index(std::string_view key) const
+	{
+		auto it = std::lower_bound(table.entries.begin(), table.entries.end(), key, [](const AttributeTable::value_type& e, std::string_view k) { return e.first < k; });
+		return (it != table.entries.end() && it->first == key) ? it - table.entries.begin() : size();
+	}
+
+	size_t size() const { return table.size(); }
+
+	// Get the value of an attribute as a string.
+	std::string_view str(size_t i) const { return (i < size()) ? table.entries[i].second : std::string_view(); }
+
+	// Get an attribute converted to type <T>, or [fallback] if there is no such attribute or its value is not a valid <T>.
+	template<typename T>
+	T get(std::string_view key, T fallback = T()) { return get<T>(index(key), fallback); }
+
+	// Get the attribute at index [i] converted to type <T>, see get().
+	template<typename T>
+	T get(size_t i, T fallback = T())
+	{
+		static_assert(std::is_arithmetic_v<T>, "Values can only be converted to numbers and bools.");
+
+		if (i >= size()) {
+			return fallback;
+		}
+
+		Cached& c = cache[i];
+
+		if constexpr (std::is_same_v<T, bool>) {
+			return (convert_once(c, Cached::as_bool, c.boolean, i)) ? c.boolean : fallback;
+		}
+		else if constexpr (std::is_floating_point_v<T>) {
+			// Values converted as doubles are rounded again as floats, which can differ in the last bit from converting them as floats.
+			if constexpr (sizeof(T) <= sizeof(double)) {
+				return (convert_once(c, Cached::as_floating, c.floating, i)) ? (T)c.floating : fallback;
+			}
+			else {
+				T value = fallback;
+				convert(str(i), value);
+				return value;
+			}
+		}
+		else if constexpr (std::is_signed_v<T>) {
+			if (!convert_once(c, Cached::as_signed, c.signed_int, i) || c.signed_int < (int64_t)std::numeric_limits<T>::min() || c.signed_int > (int64_t)std::numeric_limits<T>::max()) {
+				return fallback;
+			}
+
+			return (T)c.signed_int;
+		}
+		else {
+			if (!convert_once(c, Cached::as_unsigned, c.unsigned_int, i) || c.unsigned_int > (uint64_t)std::numeric_limits<T>::max()) {
+				return fallback;
+			}
+
+			return (T)c.unsigned_int;
+		}
+	}
+
+	// Get an attribute as a list of values, see convert_list(). Lists are not cached.
+	template<typename T>
+	bool get_list(std::string_view key, std::vector<T>& values, char separator = ',') const
+	{
+		return stn::get_list(table, key, values, separator);
+	}
+
+private:
+	// Converted forms of one value.
+	struct Cached
+	{
+		enum Kind : uint8_t
+		{
+			as_signed = 1,
+			as_unsigned = 2,
+			as_floating = 4,
+			as_bool = 8
+		};
+
+		uint8_t converted = 0; // Kinds that were converted.
+		uint8_t valid = 0; // Kinds that were converted successfully.
+		bool boolean = false;
+		int64_t signed_int = 0;
+		uint64_t unsigned_int = 0;
+		double floating = 0;
+	};
+
+	std::vector<Cached> cache;
+
+	template<typename T>
+	bool convert_once(Cached& c, Cached::Kind kind, T& value, size_t i)
+	{
+		if (!(c.converted & kind)) {
+			c.converted |= kind;
+
+			if (convert(table.entries[i].second, value))
+				c.valid |= kind;
+		}
+
+		return (c.valid & kind) != 0;
+	}
+};
+
+#if defined(__cpp_lib_memory_resource)
+namespace pmr
+{
+
+using Attributes = std::pmr::map<std::pmr::string, std::pmr::string, std::less<>>;
+using AttributeTable = BasicAttributeTable<std::pmr::polymorphic_allocator<std::pair<std::string_view, std::string_view>>>;
+
+// Parse simple text (.txt) notation files in memory.
+// All names, values and map nodes are allocated from [resource], so a monotonic arena can release them all at once.
+Attributes parse(rw::ReadStream rs, std::pmr::memory_resource* resource)
+{
+	Attributes attrs(resource);
+	detail::parse_into(rs, attrs);
+	return attrs;
+}
+
+// Parse simple text (.txt) notation files in memory without copying attribute names and values, see stn::parse_view().
+// The table is allocated from [resource].
+AttributeTable parse_view(rw::ReadStream rs, std::pmr::memory_resource* resource)
+{
+	AttributeTable attrs(resource);
+	detail::parse_into(rs, attrs);
+	return attrs;
+}
+
+// Parse simple text (.txt) notation files, allocating from [resource].
+Attributes parse(const char* filename, std::pmr::memory_resource* resource)
+{
+	return detail::parse_file(filename, [&](rw::ReadStream rs) { return parse(rs, resource); });
+}
+
+} // namespace pmr
+#endif
+
+namespace detail
+{
+
+// Seeded string hash for schemas, FNV-1a finalized with the splitmix64 mixer so that different seeds give unrelated hashes.
+constexpr uint64_t schema_hash(std::string_view str, uint64_t seed)
+{
+	uint64_t hash = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+
+	for (char c : str)
+		hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+	return hash ^ (hash >> 31);
+}
+
+} // namespace detail
+
+// Fixed set of attribute names with a minimal perfect hash, built at compile time:
+//   constexpr std::string_view names[] = { "width", "height", "title" };
+//   constexpr stn::Schema schema(names);
+// Each name maps to its own slot in [0; N), so parsed values can go straight into an array (see parse_schema()),
+// and looking up a name is one hash and one comparison. The slot of a constant name is computed at compile time.
+// Names must be unique. A constexpr schema with a duplicate name fails to compile,
+// a schema built at run time from names with a duplicate throws std::invalid_argument from its constructor.
+template<size_t N>
+struct Schema
+{
+	// Names are hashed into buckets, and each bucket gets the seed (displacement) that places its names into free slots.
+	static constexpr size_t buckets = N / 2 + 1;
+
+	std::array<std::string_view, N> names{}; // Names in slot order.
+	std::array<uint32_t, buckets> displacement{};
+
+	constexpr Schema(const std::string_view (&list)[N])
+	{
+		std::array<size_t, N> bucket_of{};
+		std::array<size_t, buckets + 1> bucket_start{};
+		std::array<size_t, N> members{}; // Indices of [list] grouped by bucket.
+		std::array<size_t, buckets> order{};
+		std::array<size_t, N> slots{};
+		std::array<bool, N> taken{};
+
+		for (size_t i = 0; i < N; i++) {
+			for (size_t j = 0; j < i; j++) {
+				if (list[j] == list[i]) {
+					throw std::invalid_argument("stn::Schema names must be unique");
+				}
+			}
+
+			bucket_of[i] = detail::schema_hash(list[i], 0) % buckets;
+			bucket_start[bucket_of[i] + 1]++;
+		}
+
+		for (size_t b = 0; b < buckets; b++)
+			bucket_start[b + 1] += bucket_start[b];
+
+		std::array<size_t, buckets> filled{};
+
+		for (size_t i = 0; i < N; i++)
+			members[bucket_start[bucket_of[i]] + filled[bucket_of[i]]++] = i;
+
+		// Place the biggest buckets first, while most slots are still free.
+		for (size_t b = 0; b < buckets; b++) {
+			size_t at = b;
+
+			for (; at > 0 && filled[order[at - 1]] < filled[b]; at--)
+				order[at] = order[at - 1];
+
+			order[at] = b;
+		}
+
+		for (size_t b : order) {
+			size_t first = bucket_start[b], count = filled[b];
+
+			if (count == 0) {
+				break;
+			}
+
+			for (uint32_t d = 1;; d++) {
+				size_t placed = 0;
+
+				for (; placed < count; placed++) {
+					size_t slot = detail::schema_hash(list[members[first + placed]], d) % N;
+					bool free = !taken[slot];
+
+					for (size_t k = 0; k < placed && free; k++)
+						free = slots[k] != slot;
+
+					if (!free) {
+						break;
+					}
+
+					slots[placed] = slot;
+				}
+
+				if (placed == count) {
+					for (size_t k = 0; k < count; k++) {
+						taken[slots[k]] = true;
+						names[slots[k]] = list[members[first + k]];
+					}
+
+					displacement[b] = d;
+					break;
+				}
+			}
+		}
+	}
+
+	static constexpr size_t size() { return N; }
+
+	// Get the slot of an attribute name, or N if the name is not in the schema.
+	constexpr size_t index(std::string_view name) const
+	{
+		size_t slot = detail::schema_hash(name, displacement[detail::schema_hash(name, 0) % buckets]) % N;
+		return (names[slot] == name) ? slot : N;
 	}
+};
+
+// Values of the attributes of a schema, indexed by Schema::index(). Missing attributes have no value.
+template<size_t N>
+using SchemaValues = std::array<std::optional<std::string_view>, N>;
+
+// Parse simple text (.txt) notation files in memory, storing the values of the attributes of [schema] in their slots of [values].
+// Values are views into the data of [rs], see parse_view() for their lifetime.
+// Attributes that are not in the schema are skipped.
+// Returns false if there were attributes that are not in the schema, so strict callers can reject the file.
+template<size_t N>
+bool parse_schema(rw::ReadStream rs, const Schema<N>& schema, SchemaValues<N>& values)
+{
+	std::string_view key;
+	bool all_known = true;
 
-	size_t matched_size = 0;
-	size_t found = 0;
+	detail::parse_lines(rs, rs.size, key, [&](std::string_view name, std::string_view val) {
+		size_t slot = schema.index(name);
 
-	for (size_t current = 0; current < container_size;) {
-		if (container_start[current++] == seq_start[matched_size]) {
-			matched_size++;
+		if (slot < N) {
+			values[slot] = val;
 		}
 		else {
-			matched_size = 0;
-			found = current;
-			continue;
-		}
-
-		if (matched_size == seq_size) {
-			break;
+			all_known = false;
 		}
-	}
+	});
 
-	return found;
+	return all_known;
 }
 
-// Check if a file exists.
-bool exists(const char* filename)
+// Header of a compiled attribute file, see compile().
+// A compiled file contains the header, a table of [count] entries sorted by attribute name, and a string table of names and values.
+// It is written in host byte order and is meant as a cache on the machine that compiled it.
+struct CompiledHeader
 {
-	FILE* f = fopen(filename, "r");
+	char magic[4] = { 'S', 'T', 'N', 'C' };
+	uint32_t version = 1;
+	uint64_t source_size = 0; // Size of the text file the attributes were parsed from.
+	int64_t source_mtime = 0; // Modification time of the text file, in nanoseconds.
+	uint64_t source_hash = 0; // FNV-1a hash of the text file, or 0.
+	uint64_t count = 0; // Number of entries.
+	uint64_t strings_size = 0; // Size of the string table.
+};
 
-	if (f) {
-		fclose(f);
-		return true;
-	}
+// Entry of a compiled attribute file, offsets are relative to the start of the string table.
+struct CompiledEntry
+{
+	uint64_t name_offset;
+	uint64_t name_size;
+	uint64_t value_offset;
+	uint64_t value_size;
+};
+
+namespace detail
+{
 
-	return false;
+// 64-bit FNV-1a hash of a buffer.
+uint64_t fnv1a(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+
+	return hash;
 }
 
-// Read file as a string and return it.
-// Parameters:
-//   [name] The name of the file.
-//   [openmode_binary] If true, open file in binary mode, otherwise text mode.
-//   [start] The starting position in the file to read from.
-//   [readsize] If -1, read whole file from [start] (Note: be careful when trying to read very large files, reading them as a whole is not recommended).
-std::string readfile(
-	const char* name,
-	bool openmode_binary = 0,
-	long start = 0,
-	size_t readsize = -1
-) {
-	std::string str;
-	FILE* f = fopen(name, ((openmode_binary) ? "rb" : "r"));
+} // namespace detail
 
-	if (f) {
-		if (readsize == -1) {
-			fseek(f, 0, SEEK_END);
-			str.resize(ftell(f) - start);
-		}
-		else {
-			str.resize(readsize);
-		}
+// Compile parsed attributes into the binary format described by CompiledHeader.
+// [attrs] must be sorted by name without duplicates, like the results of parse() and parse_view().
+// [source] carries the size, modification time and hash of the text file, used to check if the compiled file is up to date.
+template<typename Attrs, typename Allocator>
+void compile(const Attrs& attrs, rw::BasicWriteStream<Allocator>& ws, CompiledHeader source = {})
+{
+	source.count = 0;
+	source.strings_size = 0;
 
-		fseek(f, start, SEEK_SET);
-		fread(str.data(), 1, str.size(), f);
-		fclose(f);
+	for (const auto& attr : attrs) {
+		source.count++;
+		source.strings_size += std::string_view(attr.first).size() + std::string_view(attr.second).size();
 	}
 
-	return str;
-}
+	size_t entries_at = ws.pos + sizeof(CompiledHeader);
+	size_t strings_at = entries_at + source.count * sizeof(CompiledEntry);
+	uint8_t* out = ws.prepare(strings_at - ws.pos + source.strings_size);
+	uint64_t offset = 0;
 
-// Write data to file.
-// Parameters:
-//   [start] The starting position in the file to read from:
-//   - If -1, write at the end of file.
-//   - Otherwise, write from that position.
-//   [truncate] If true, truncate the file, otherwise open the file and overwrite data.
-void writefile(
-	const char* name,
-	void* data,
-	size_t readsize,
-	long start = 0,
-	bool overwrite = true
-) {
-	FILE* f = fopen(name, (overwrite) ? "wb" : "ab");
+	memcpy(out, &source, sizeof(source));
+	out += sizeof(source);
 
-	if (f) {
-		if (start == -1) {
-			fseek(f, 0, SEEK_END);
-		}
+	for (const auto& attr : attrs) {
+		std::string_view name = attr.first, value = attr.second;
+		CompiledEntry entry = { offset, name.size(), offset + name.size(), value.size() };
 
-		fwrite(data, 1, readsize, f);
-		fclose(f);
+		memcpy(out, &entry, sizeof(entry));
+		out += sizeof(entry);
+		offset += name.size() + value.size();
 	}
-}
 
-// Write log message to an output text file.
-// Parameters:
-//   [overwrite] If true, overwrite the file, otherwise append data.
-// Note:
-// This function is useful for writing error logs into a text file. When terminate() or abort() is called, data written to existing file streams may not be written to files. This is a problem because when a fatal error occurs in an application, either function is called. No error information is written, so there's no way to diagnose fatal errors!
-void log(
-	const char* name,
-	const char* message,
-	bool overwrite = false
-) {
-	FILE* f = fopen(name, ((overwrite) ? "w" : "a"));
+	for (const auto& attr : attrs) {
+		std::string_view name = attr.first, value = attr.second;
 
-	if (f) {
-		fputs(message, f);
-		fclose(f);
+		memcpy(out, name.data(), name.size());
+		memcpy(out + name.size(), value.data(), value.size());
+		out += name.size() + value.size();
 	}
+
+	ws.commit(strings_at - ws.pos + source.strings_size);
 }
 
-// Create strings by chaining operators.
-struct concat
+// Attributes of a compiled file, looked up in place without copying or allocating per entry.
+// The data is a memory mapping of the compiled file, or a buffer compiled in memory by load_cached().
+struct CompiledTable
 {
-	operator const char*() const { return str.c_str(); }
+	using value_type = std::pair<std::string_view, std::string_view>;
 
-	std::exception error() const { return std::exception(str.c_str()); }
+	rw::MappedFile file;
+	rw::WriteStream buffer;
+	CompiledHeader header;
 
-	concat(const char* msg = "") { str += msg; }
-	concat(const std::string& msg) { str += msg; }
+	CompiledTable() = default;
+	CompiledTable(const char* name) { open(name); }
 
-	// Append string to the string.
-	concat& operator()(const char* msg)
-	{
-		str += msg;
-		return *this;
-	}
+	// Check if a valid compiled file is loaded.
+	explicit operator bool() const { return entries != nullptr; }
 
-	// Append string to the string.
-	concat& operator()(const std::string& msg)
+	// Map a compiled file.
+	// Returns false if the file cannot be mapped or is not a valid compiled file, including one whose entries are not sorted by name.
+	bool open(const char* name)
 	{
-		str += msg;
-		return *this;
+		buffer = {};
+		entries = nullptr;
+
+		return file.open(name) && load(file.data, file.size);
 	}
 
-	// Append [count] characters to the string.
-	concat& operator()(char c, size_t count = 1)
+	// Use [ws] holding a compiled file as the data.
+	bool open(rw::WriteStream&& ws)
 	{
-		str.resize(count + str.size(), c);
-		return *this;
+		file.close();
+		buffer = std::move(ws);
+		entries = nullptr;
+
+		return load((const char*)buffer.data(), buffer.size());
 	}
-	
-	// Append a value to the string.
-	// <T> must have 'to_string' function that takes [val] as the parameter and returns std::string.
-	template<typename T>
-	concat& operator()(const T& val)
-	{
-		using std::to_string;
 
-		str += to_string(val);
-		return *this;
+	size_t size() const { return (entries) ? (size_t)header.count : 0; }
+	bool empty() const { return size() == 0; }
+
+	// Get the entry at [index] in name order.
+	value_type entry(size_t index) const
+	{
+		const CompiledEntry& e = entries[index];
+		return { { strings + e.name_offset, (size_t)e.name_size }, { strings + e.value_offset, (size_t)e.value_size } };
 	}
 
-	std::string str;
-};
+	// Find the value of an attribute.
+	// Returns false if there is no such attribute.
+	bool find(std::string_view key, std::string_view& value) const
+	{
+		size_t lo = 0, hi = size();
 
-// A read-only stream of data with a position pointer, data pointer and size.
-// Read operations move the position pointer forward.
-// This is used to read embedded data without extra copying costs.
-struct ReadStream
-{
-	const char* data;
-	size_t size;
-	size_t pos = 0; // The current read position.
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			value_type e = entry(mid);
 
-	ReadStream(const char* data, size_t size) : data(data), size(size) {}
+			if (e.first < key) {
+				lo = mid + 1;
+			}
+			else if (key < e.first) {
+				hi = mid;
+			}
+			else {
+				value = e.second;
+				return true;
+			}
+		}
 
-	// Check if the read position pointer is not at or past the end of the stream.
-	operator bool() const { return pos < size; }
+		return false;
+	}
 
-	// Find a string in the data, starting from the read position pointer location.
-	// Returns:
-	// - -1 if [str] is empty, or if the read position pointer value is bigger than the size of the stream.
-	// - The size of the stream if [str] is not found.
-	// - The location of the first character of [str] if [str] is found.
-	size_t find(const std::string& str) const
+	// Get the value of an attribute, or an empty view if there is no such attribute.
+	std::string_view operator[](std::string_view key) const
 	{
-		return pos + find_sequence(data + pos, (size < pos) ? 0 : size - pos, str.data(), str.size());
+		std::string_view value;
+		find(key, value);
+		return value;
 	}
 
-	// Read a value.
-	template<typename T>
-	T read()
+	size_t count(std::string_view key) const
 	{
-		T t{};
-		read(&t, sizeof T);
-		return t;
+		std::string_view value;
+		return find(key, value);
 	}
 
-	// Read bytes into destination, returns the number of bytes read.
-	size_t read(void* destination, size_t readsize)
+private:
+	const CompiledEntry* entries = nullptr;
+	const char* strings = nullptr;
+
+	bool load(const char* data, size_t data_size)
 	{
-		char* dest = (char*)destination;
-		size_t read = pos;
+		const CompiledHeader expected;
 
-		for (size_t i = 0; i < readsize && pos < size; i++, pos++)
-			dest[i] = data[pos];
+		if (data_size < sizeof(CompiledHeader)) {
+			return false;
+		}
 
-		return pos - read;
-	}
-	
-	// Read the data in range [read position pointer; _pos).
-	std::string readUntil(size_t _pos)
-	{
-		if (_pos < pos) {
-			return "";
+		memcpy(&header, data, sizeof(header));
+
+		if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version) {
+			return false;
 		}
 
-		std::string str(_pos - pos, '\0');
+		size_t available = data_size - sizeof(CompiledHeader);
 
-		read(str.data(), str.size());
-		return str;
-	}
+		if (header.count > available / sizeof(CompiledEntry) || header.strings_size != available - header.count * sizeof(CompiledEntry)) {
+			return false;
+		}
 
-	// Read the data all the way until [rule] is not met.
-	// Note: The position pointer will be incremented, regardless if [rule] is met.
-	std::string readWhile(const std::function<bool(char)>& rule)
-	{
-		size_t begin = pos;
-		size_t chars = 0;
+		const CompiledEntry* table = (const CompiledEntry*)(data + sizeof(CompiledHeader));
+		const char* table_strings = (const char*)(table + header.count);
+		std::string_view previous;
 
-		while (pos < size) {
-			if (!rule(data[pos++])) {
-				break;
+		// find() is a binary search, which needs names in strictly increasing order.
+		for (size_t i = 0; i < header.count; i++) {
+			const CompiledEntry& e = table[i];
+
+			if (e.name_offset > header.strings_size || e.name_size > header.strings_size - e.name_offset
+				|| e.value_offset > header.strings_size || e.value_size > header.strings_size - e.value_offset) {
+				return false;
 			}
-			else {
-				chars++;
+
+			std::string_view name(table_strings + e.name_offset, (size_t)e.name_size);
+
+			if (i > 0 && !(previous < name)) {
+				return false;
 			}
+
+			previous = name;
 		}
 
-		return std::string(&data[begin], chars);
+		entries = table;
+		strings = table_strings;
+		return true;
 	}
 };
 
-// Write stream containing a buffer that can be read.
-// Write operations move the position index forward.
-struct WriteStream : public std::vector<uint8_t>
+// Load the attributes of a text notation file through its compiled cache file.
+// The cache is used if its source size and modification time match the text file (and also its hash, if [verify_hash] is true).
+// Otherwise the text file is parsed, and the cache is compiled and replaced with writefile_atomic(), so a crash or a concurrent
+// load_cached() never leaves a partly written cache behind.
+// Returns false if neither the cache nor the text file can be loaded.
+bool load_cached(const char* filename, const char* cache_name, CompiledTable& table, bool verify_hash = false)
 {
-	size_t pos = 0; // Byte position index.
+	CompiledHeader source;
+	rw::FileInfo info = rw::file_info(filename);
+	bool have_source = info.exists;
 
-	void expand(size_t num_bytes) { resize(size() + num_bytes); }
+	source.source_size = info.size;
+	source.source_mtime = info.mtime;
 
-	// Write padding bytes to the buffer.
-	void pad(size_t num_bytes) { expand(num_bytes); pos = size(); }
+	if (table.open(cache_name) && (!have_source || (table.header.source_size == source.source_size && table.header.source_mtime == source.source_mtime))) {
+		if (!verify_hash || !have_source) {
+			return true;
+		}
 
-	// Write a byte to the buffer.
-	void put(uint8_t b)
-	{
-		if (pos + 1 > size())
-			expand(1);
+		bool same = detail::parse_file(filename, [&](rw::ReadStream rs) { return detail::fnv1a(rs.data, rs.size) == table.header.source_hash; });
 
-		operator[](pos) = b;
-		pos++;
+		if (same) {
+			return true;
+		}
 	}
 
-	// Write a value to the buffer in binary form.
-	template<typename T>
-	void write(const T& value) { write((uint8_t*)&value, sizeof(T)); }
+	if (!have_source) {
+		return false;
+	}
 
-	// Write [writesize] bytes from source to the buffer.
-	void write(const void* source, size_t writesize)
-	{
-		const uint8_t* src = (uint8_t*)source;
+	rw::WriteStream ws;
 
-		if (writesize + pos > size())
-			resize(writesize + pos);
+	detail::parse_file(filename, [&](rw::ReadStream rs) {
+		source.source_hash = detail::fnv1a(rs.data, rs.size);
+		compile(parse_view(rs), ws, source);
+		return true;
+	});
 
-		for (size_t i = 0; i < writesize; i++, pos++)
-			operator[](pos) = src[i];
-	}
-};
+	// Unmap a stale cache first, Windows cannot replace a mapped file.
+	table.file.close();
+	rw::writefile_atomic(cache_name, ws.data(), ws.size());
+	return table.open(std::move(ws));
+}
 
-} // |===|   END namespace rw   |===|
+namespace detail
+{
 
+// Location of a parsed attribute in the file data, used to reparse only the changed part of a file.
+struct Record
+{
+	size_t begin; // Start of the name line.
+	size_t end; // Past the value line, or past the multiline terminator.
+	size_t value;
+	size_t name_size;
+	size_t value_size;
+};
 
+} // namespace detail
 
-namespace stn
+// Attributes of a file that are reloaded whenever the file changes.
+// A reload only parses the records around the bytes that differ from the previous version, and publishes the result as a new immutable
+// Snapshot by swapping an atomic pointer. Readers keep the snapshot they got for as long as they need it, so they never wait for a reload.
+// Note: Use a Reader per thread to get the latest attributes with a single atomic load on the hot path.
+struct WatchedFile
 {
+	struct Snapshot
+	{
+		std::string data; // The file contents.
+		AttributeTable table; // Views into [data].
+		uint64_t version = 0;
+	};
 
-// Parse simple text (.txt) notation files in memory.
-std::map<std::string, std::string> parse(rw::ReadStream rs)
-{
-	std::map<std::string, std::string> attrs;
-	std::string key;
+	// Cached latest snapshot of a WatchedFile, for one thread.
+	struct Reader
+	{
+		explicit Reader(const WatchedFile& file) : file(file), current(file.snapshot()) {}
 
-	while (rs) {
-		std::string line = rs.readWhile([](char c) { return c != '\n'; });
+		// Get the attributes of the latest snapshot.
+		// The table stays valid until the next call.
+		const AttributeTable& get()
+		{
+			if (file.published.load(std::memory_order_acquire) != current->version)
+				current = file.snapshot();
 
-		if (line.empty() || line[0] == '#') {
-			if (!key.empty()) {
-				attrs[key] = line;
-				key.clear();
-			}
-			continue;
+			return current->table;
 		}
 
-		if (key.empty()) {
-			key = line;
+	private:
+		const WatchedFile& file;
+		std::shared_ptr<const Snapshot> current;
+	};
+
+	// Load the file, and if [watch] is true, reload it with a FileWatcher whenever it changes.
+	// If the file cannot be read, the attributes are empty until it can.
+	WatchedFile(const char* filename, bool watch = true) : filename(filename)
+	{
+		publish(std::make_shared<Snapshot>());
+
+		// Watch before the first load, so no change can be missed in between.
+		if (watch)
+			watcher = std::make_unique<rw::FileWatcher>(filename, [this]() { reload(); });
+
+		reload();
+	}
+
+	WatchedFile(const WatchedFile&) = delete;
+	WatchedFile& operator=(const WatchedFile&) = delete;
+
+	// Get the latest snapshot.
+	std::shared_ptr<const Snapshot> snapshot() const
+	{
+#if defined(__cpp_lib_atomic_shared_ptr)
+		return current.load(std::memory_order_acquire);
+#else
+		return std::atomic_load_explicit(&current, std::memory_order_acquire);
+#endif
+	}
+
+	// Get the version of the latest snapshot, it is incremented by every reload that changed the file data.
+	uint64_t version() const { return published.load(std::memory_order_acquire); }
+
+	// Read the file again and publish a new snapshot if its data changed.
+	// This is called by the watcher, but can also be called directly.
+	// Returns false if the file cannot be read or did not change.
+	bool reload()
+	{
+		std::lock_guard<std::mutex> lock(reloading);
+		rw::File f(filename.c_str());
+
+		if (!f) {
+			return false;
 		}
-		else {
-			if (line == "[MULTILINE]") {
-				line = rs.readUntil(rs.find("\n[END_MULTILINE]\n"));
+
+		std::string data(f.size(), '\0');
+
+		data.resize(f.pread(data.data(), data.size(), 0));
+
+		std::shared_ptr<const Snapshot> old = snapshot();
+		const std::string& prev = old->data;
+
+		if (old->version && data == prev) {
+			return false;
+		}
+
+		// The bytes before [prefix] and the last [suffix] bytes are the same in both versions.
+		size_t prefix = std::mismatch(prev.begin(), prev.begin() + std::min(prev.size(), data.size()), data.begin()).first - prev.begin();
+		size_t suffix = 0;
+
+		while (suffix < std::min(prev.size(), data.size()) - prefix && prev[prev.size() - 1 - suffix] == data[data.size() - 1 - suffix])
+			suffix++;
+
+		// Records that end before the first changed byte are parsed the same way again.
+		// A record that runs to the end of the old data could continue in the new data, so it is parsed again.
+		size_t kept = 0;
+
+		while (kept < records.size() && records[kept].end <= prefix && records[kept].end < prev.size())
+			kept++;
+
+		std::vector<detail::Record> next(records.begin(), records.begin() + kept);
+		rw::ReadStream rs(data.data(), data.size());
+		std::string_view key;
+
+		rs.pos = (kept) ? records[kept - 1].end : 0;
+
+		// Records starting in the unchanged end are moved by the size difference, this can wrap around but the sums are right.
+		const size_t shift = data.size() - prev.size();
+		size_t j = kept;
+
+		while (j < records.size() && records[j].begin < prev.size() - suffix)
+			j++;
+
+		// Parse up to the start of an old record in the unchanged end. If the parser is between records there, it is back in sync
+		// and the remaining old records are still valid, otherwise try the next one.
+		for (;;) {
+			size_t sync = (j < records.size()) ? records[j].begin + shift : data.size();
+
+			detail::parse_lines(rs, sync, key, [&](std::string_view name, std::string_view val) {
+				next.push_back({ size_t(name.data() - data.data()), rs.pos, size_t(val.data() - data.data()), name.size(), val.size() });
+			});
+
+			if (j >= records.size() || (key.empty() && rs.pos == sync)) {
+				break;
 			}
 
-			attrs[key] = line;
-			key.clear();
+			for (j++; j < records.size() && records[j].begin + shift < rs.pos;)
+				j++;
+		}
+
+		for (; j < records.size(); j++) {
+			detail::Record r = records[j];
+
+			r.begin += shift;
+			r.end += shift;
+			r.value += shift;
+			next.push_back(r);
 		}
+
+		std::shared_ptr<Snapshot> snap = std::make_shared<Snapshot>();
+
+		snap->data = std::move(data);
+		snap->table.entries.reserve(next.size());
+
+		for (const detail::Record& r : next)
+			snap->table.entries.emplace_back(std::string_view(snap->data.data() + r.begin, r.name_size), std::string_view(snap->data.data() + r.value, r.value_size));
+
+		snap->table.sort_unique();
+		snap->version = old->version + 1;
+		records = std::move(next);
+		publish(std::move(snap));
+		return true;
 	}
 
-	return attrs;
-}
+private:
+	std::string filename;
+	std::vector<detail::Record> records; // Records of the latest snapshot, in file order.
+	std::mutex reloading;
+	std::atomic<uint64_t> published{ 0 };
 
-// Parse simple text (.txt) notation files.
-std::map<std::string, std::string> parse(const char* filename)
-{
-	std::string str = rw::readfile(filename);
-	return parse({ str.data(), str.size() });
-}
+#if defined(__cpp_lib_atomic_shared_ptr)
+	std::atomic<std::shared_ptr<const Snapshot>> current;
+#else
+	std::shared_ptr<const Snapshot> current; // Accessed with std::atomic_load() and std::atomic_store().
+#endif
+
+	// Destroyed first, so reloads stop before the rest of the object goes away.
+	std::unique_ptr<rw::FileWatcher> watcher;
+
+	void publish(std::shared_ptr<const Snapshot> snap)
+	{
+		uint64_t version = snap->version;
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+		current.store(std::move(snap), std::memory_order_release);
+#else
+		std::atomic_store_explicit(&current, std::move(snap), std::memory_order_release);
+#endif
+		published.store(version, std::memory_order_release);
+	}
+};
 
 } // |===|   END namespace stn   |===|
\ No newline at end of file
@@ -0,0 +1,1360 @@
+﻿#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// The counters are compiled in, so that the checks also cover the instrumented paths.
+#define RW_INSTRUMENT
+#include "readwrite_data.h"
+
+#if defined(RW_TEST_LZ4)
+#include <lz4.h>
+#endif
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <sys/wait.h>
+#endif
+
+// Checks of readwrite_data.h, build and run with: c++ -std=c++17 -pthread tests.cpp && ./a.out
+// Building with -std=gnu++17 also checks formatting of the __int128 extension.
+// Define RW_TEST_LZ4 and link with -llz4 to also check that blocks of the built-in LZ4 codec and of the LZ4 library are interchangeable.
+// Checks whose names contain [filter] are run. Checks named "large/..." write and read files of more than 1 GB, they only run when the filter names them.
+
+static const char* filter = "";
+static int failures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+// Run [body] if its name matches the filter.
+template<typename Body>
+void check(const std::string& name, Body&& body)
+{
+	bool large = (name.compare(0, 6, "large/") == 0);
+
+	if (name.find(filter) == std::string::npos || (large && !*filter)) {
+		return;
+	}
+
+	int before = failures;
+
+	body();
+	printf("%-40s %s\n", name.c_str(), (failures == before) ? "ok" : "FAILED");
+}
+
+// Create a sparse file of [size] bytes that starts with "begin" and ends with "end".
+void make_sparse_file(const char* name, uint64_t size)
+{
+	rw::File f(name, rw::File::writable | rw::File::create | rw::File::truncate);
+
+	f.pwrite("begin", 5, 0);
+	f.pwrite("end", 3, size - 3);
+}
+
+#if !defined(_WIN32)
+// Count the files in the current directory whose names start with [prefix].
+size_t count_files(const std::string& prefix)
+{
+	size_t count = 0;
+	DIR* dir = opendir(".");
+
+	while (dirent* entry = readdir(dir)) {
+		if (std::string(entry->d_name).compare(0, prefix.size(), prefix) == 0)
+			count++;
+	}
+
+	closedir(dir);
+	return count;
+}
+#endif
+
+// Reference search for find_sequence().
+template<typename T>
+size_t naive_find(const std::vector<T>& h, const std::vector<T>& n)
+{
+	if (n.empty()) {
+		return 0;
+	}
+
+	for (size_t i = 0; i + n.size() <= h.size(); i++) {
+		if (std::equal(n.begin(), n.end(), h.begin() + i))
+			return i;
+	}
+
+	return h.size();
+}
+
+void check_search()
+{
+	check("search/find_sequence", [&]() {
+		std::mt19937 rng(1);
+
+		auto compare = [&](auto element) {
+			using T = decltype(element);
+
+			for (int i = 0; i < 20000; i++) {
+				// Few distinct values make partial matches common, long haystacks cover the vector loops and tails.
+				unsigned values = 1 + rng() % 4;
+				std::vector<T> h(rng() % ((i % 10 == 0) ? 2000 : 80)), n(rng() % ((i % 7 == 0) ? 300 : 6));
+
+				for (T& c : h)
+					c = (T)(rng() % values);
+
+				for (T& c : n)
+					c = (T)(rng() % values);
+
+				// Often search for a part of the haystack, so that there is a match.
+				if (rng() % 2 && n.size() <= h.size()) {
+					size_t at = rng() % (h.size() - n.size() + 1);
+					n.assign(h.begin() + at, h.begin() + at + n.size());
+				}
+
+				CHECK(rw::find_sequence(h.data(), h.size(), n.data(), n.size()) == naive_find(h, n));
+			}
+		};
+
+		compare(char());
+		compare(uint8_t());
+		compare(int());
+
+		std::string text = "name\n[MULTILINE]\nvalue\n[/MULTILINE]\n";
+		CHECK(rw::find_sequence(text.data(), text.size(), "[/MULTILINE]", 12) == 23);
+		CHECK(rw::find_sequence(text.data(), text.size(), "[/MULTILINX]", 12) == text.size());
+	});
+}
+
+void check_async_io()
+{
+	const char* name = "tests_async.bin";
+
+	auto read_back = [&](rw::AsyncIO& io) {
+		std::vector<char> data(300000);
+
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = (char)(i * 7);
+
+		CHECK(io.writefile(name, data.data(), data.size()).get() == data.size());
+		CHECK(io.readfile(name).get() == std::string(data.data(), data.size()));
+
+		rw::File file(name);
+		std::vector<rw::AsyncIO::Request> batch;
+		std::vector<std::string> blocks(100, std::string(4096, 0));
+
+		for (size_t i = 0; i < blocks.size(); i++)
+			batch.push_back({ &file, blocks[i].data(), 4096, i * 2000, false });
+
+		std::vector<std::future<size_t>> results = io.submit(batch);
+
+		for (size_t i = 0; i < blocks.size(); i++) {
+			CHECK(results[i].get() == 4096);
+			CHECK(memcmp(blocks[i].data(), data.data() + i * 2000, 4096) == 0);
+		}
+
+		// Reads past the end are short, failed requests hold their error.
+		std::string tail(100, 0);
+		CHECK(io.read(file, tail.data(), tail.size(), data.size() - 10).get() == 10);
+
+		bool failed = false;
+
+		try {
+			io.write(file, "x", 1, 0).get();
+		}
+		catch (const std::system_error& e) {
+			failed = (e.code().value() != 0);
+		}
+
+		CHECK(failed);
+	};
+
+	check("async_io/" + std::string((rw::AsyncIO().uses_io_uring()) ? "io_uring" : "threads"), [&]() {
+		rw::AsyncIO io;
+		read_back(io);
+	});
+
+	// Transfers through io_uring are capped at 1 GiB each, the rest has to be submitted again.
+	check("large/async_readfile", [&]() {
+		uint64_t size = (1200ull << 20);
+
+		make_sparse_file(name, size);
+
+		rw::AsyncIO io;
+		std::string str = io.readfile(name).get();
+
+		CHECK(str.size() == size);
+		CHECK(str.compare(0, 5, "begin") == 0 && str.compare(str.size() - 3, 3, "end") == 0);
+	});
+
+	remove(name);
+}
+
+void check_logger()
+{
+	const char* name = "tests_log.txt";
+
+	check("logger/messages", [&]() {
+		{
+			rw::Logger log(name, true, 64);
+
+			for (int i = 0; i < 100; i++)
+				log("message " + std::to_string(i) + "\n");
+		}
+
+		std::string text = rw::readfile(name);
+		CHECK(text.compare(0, 10, "message 0\n") == 0);
+		CHECK(text.size() > 12 && text.compare(text.size() - 11, 11, "message 99\n") == 0);
+	});
+
+#if !defined(_WIN32)
+	// A handler of the application stays installed, and is called after the messages are written.
+	check("logger/fatal_signal", [&]() {
+		pid_t child = fork();
+
+		if (child == 0) {
+			struct sigaction action = {};
+
+			action.sa_handler = [](int) { _exit(42); };
+			sigaction(SIGSEGV, &action, nullptr);
+
+			rw::Logger log(name, true);
+			struct sigaction kept;
+
+			sigaction(SIGSEGV, nullptr, &kept);
+
+			if (kept.sa_handler != action.sa_handler) {
+				_exit(1);
+			}
+
+			rw::Logger::catch_fatal_signals();
+			log("before the crash\n");
+			raise(SIGSEGV);
+			_exit(2);
+		}
+
+		int status = 0;
+
+		waitpid(child, &status, 0);
+		CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 42);
+		CHECK(rw::readfile(name) == "before the crash\n");
+	});
+#endif
+
+	remove(name);
+}
+
+void check_files()
+{
+	const char* name = "tests_file.txt";
+
+	check("files/readfile", [&]() {
+		rw::writefile(name, (void*)"hello", 5);
+		CHECK(rw::exists(name) && !rw::exists("tests_missing.txt"));
+		CHECK(rw::readfile(name) == "hello" && rw::readfile(name, true, 1, 3) == "ell");
+
+		// Writing at the end without overwriting appends.
+		rw::writefile(name, (void*)" world", 6, -1, false);
+		CHECK(rw::readfile(name, true) == "hello world");
+		CHECK(rw::readfile("tests_missing.txt").empty());
+	});
+
+	check("files/mapped_file", [&]() {
+		std::string data = "name\nvalue\nother\n[MULTILINE]\na\nb\n[END_MULTILINE]\n";
+		std::map<std::string, std::string> expected = stn::parse(rw::ReadStream(data.data(), data.size()));
+
+		rw::writefile(name, data.data(), data.size());
+
+		{
+			rw::MappedFile file(name);
+			CHECK(file && file.size == data.size() && std::string(file.data, file.size) == data);
+			CHECK(stn::parse(file.stream()) == expected);
+
+			rw::MappedFile moved = std::move(file);
+			CHECK(moved && !file && moved.size == data.size());
+		}
+
+		CHECK(stn::parse(name) == expected);
+		CHECK(!rw::MappedFile("tests_missing.txt"));
+		CHECK(stn::parse("tests_missing.txt").empty());
+
+		rw::writefile(name, data.data(), 0);
+
+		{
+			rw::MappedFile empty(name);
+			CHECK(empty.size == 0 && empty.stream().size == 0);
+		}
+
+		CHECK(stn::parse(name).empty());
+	});
+
+	check("files/positional", [&]() {
+		{
+			rw::File file(name, rw::File::readable | rw::File::writable | rw::File::create | rw::File::truncate);
+			char buf[16] = {};
+
+			CHECK(file && file.pwrite("world", 5, 6) == 5 && file.pwrite("hello ", 6, 0) == 6 && file.size() == 11);
+			CHECK(file.pread(buf, sizeof(buf), 0) == 11 && std::string(buf, 11) == "hello world");
+			CHECK(file.pread(buf, 4, 20) == 0);
+
+			// More buffers than one vectored call takes (IOV_MAX is 1024 on Linux).
+			std::vector<std::string> out(1500), in(1500);
+			size_t total = 0;
+
+			for (size_t i = 0; i < out.size(); i++) {
+				out[i] = std::string(1 + i % 7, (char)('a' + i % 26));
+				in[i].resize(out[i].size());
+				total += out[i].size();
+			}
+
+			CHECK(file.writev(out.data(), out.size(), 11) == total && file.size() == 11 + total);
+			CHECK(file.readv(in.data(), in.size(), 11) == total && in == out);
+
+			// Reads at the end are short, the buffers after the last byte are left as they are.
+			in.assign(3, std::string(8, '-'));
+			CHECK(file.readv(in.data(), in.size(), 11 + total - 10) == 10 && in[1].compare(0, 2, out.back().substr(out.back().size() - 2)) == 0);
+			CHECK(in[2] == "--------");
+			CHECK(file.sync());
+		}
+
+		CHECK(rw::readfile(name, true).compare(0, 11, "hello world") == 0);
+		CHECK(!rw::File("tests_missing.txt"));
+	});
+
+	check("files/read_batch", [&]() {
+		rw::writefile("tests_batch_a.txt", (void*)"abc", 3);
+		rw::writefile("tests_batch_b.txt", (void*)"", 0);
+
+		std::vector<std::string> paths = { "tests_batch_a.txt", "tests_batch_b.txt", ".", "tests_missing.txt" };
+		rw::FileBatch batch = rw::read_batch(paths, {}, 2);
+
+		CHECK(batch.files[0].ok && std::string(batch.files[0].data, batch.files[0].size) == "abc");
+		CHECK(batch.files[1].ok && batch.files[1].size == 0);
+		CHECK(!batch.files[2].ok && !batch.files[3].ok);
+
+		rw::detail::BatchArena arena;
+		arena.allocate(0);
+		arena.allocate(10);
+		CHECK(arena.blocks.size() == 1 && arena.left == rw::detail::BatchArena::min_block_size - 10);
+
+		remove("tests_batch_a.txt");
+		remove("tests_batch_b.txt");
+	});
+
+	check("files/transaction", [&]() {
+		const char* names[] = { "tests_transaction_a.txt", "tests_transaction_b.txt", "tests_transaction_c.txt" };
+
+		rw::writefile(names[0], (void*)"old", 3);
+		remove(names[1]);
+		remove(names[2]);
+
+		// The temporary files are removed without touching the targets when a transaction ends without a commit.
+		{
+			rw::FileTransaction transaction;
+
+			CHECK(transaction.write(names[0], "new a", 5) && transaction.write(names[1], "new b", 5));
+			CHECK(rw::readfile(names[0]) == "old" && !rw::exists(names[1]));
+		}
+
+		{
+			rw::FileTransaction transaction;
+
+			CHECK(transaction.write(names[0], "new a", 5));
+			transaction.rollback();
+			CHECK(transaction.commit());
+		}
+
+		CHECK(rw::readfile(names[0]) == "old" && !rw::exists(names[1]));
+#if !defined(_WIN32)
+		CHECK(count_files("tests_transaction_") == 1);
+#endif
+
+		// A commit replaces every target.
+		{
+			rw::FileTransaction transaction;
+
+			for (const char* target : names)
+				CHECK(transaction.write(target, target, strlen(target)));
+
+			CHECK(transaction.commit());
+		}
+
+		for (const char* target : names)
+			CHECK(rw::readfile(target) == target);
+#if !defined(_WIN32)
+		CHECK(count_files("tests_transaction_") == 3);
+#endif
+
+		// A write into a missing directory fails and leaves nothing behind.
+		CHECK(!rw::writefile_atomic("tests_missing/file.txt", "x", 1) && !rw::exists("tests_missing/file.txt"));
+		CHECK(rw::writefile_atomic(names[0], "atomic", 6) && rw::readfile(names[0]) == "atomic");
+#if !defined(_WIN32)
+		CHECK(count_files("tests_transaction_") == 3);
+#endif
+
+		for (const char* target : names)
+			remove(target);
+	});
+
+	check("files/file_info", [&]() {
+		rw::writefile(name, (void*)"hello", 5);
+
+		rw::FileInfo info = rw::file_info(name);
+		CHECK(info && !info.directory && info.size == 5 && info.mtime > 0);
+
+		FILE* f = fopen(name, "rb");
+		rw::FileInfo open_info = rw::file_info(f);
+		fclose(f);
+
+		CHECK(open_info.size == info.size && open_info.mtime == info.mtime);
+		CHECK(rw::file_info(".").directory);
+		CHECK(!rw::file_info("tests_missing.txt"));
+		CHECK(rw::exists(name) && rw::exists(".") && !rw::exists("tests_missing.txt"));
+		CHECK(rw::readfile(name, true) == "hello" && rw::readfile(name, true, 3) == "lo" && rw::readfile(name, true, 9).empty());
+	});
+
+	check("files/directory_cache", [&]() {
+		rw::DirectoryCache cache;
+
+		CHECK(cache.exists(name) && !cache.exists("tests_missing.txt"));
+		CHECK(cache.exists("./" + std::string(name)) && cache.exists("."));
+		CHECK(!cache.exists("tests_missing/file.txt"));
+
+		// Root level paths are listed from the root, not from the current directory.
+#if defined(_WIN32)
+		const char* root_entry = "C:\\Windows";
+#else
+		const char* root_entry = "/tmp";
+#endif
+		CHECK(cache.exists(root_entry) == rw::exists(root_entry));
+		CHECK(!cache.exists("/tests_missing_root_entry"));
+
+		remove(name);
+		CHECK(cache.exists(name));
+		cache.invalidate("./");
+		cache.invalidate("");
+		CHECK(!cache.exists(name));
+	});
+
+	check("files/readfile_chunks", [&]() {
+		std::string data(10000, 0);
+
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = (char)(i * 13);
+
+		rw::writefile(name, data.data(), data.size());
+
+		std::string back;
+		uint64_t next = 0;
+		bool in_order = true;
+
+		CHECK(rw::readfile_chunks(name, [&](const char* chunk, size_t size, uint64_t offset) {
+			in_order &= (offset == next && size <= 3000);
+			next += size;
+			back.append(chunk, size);
+			return true;
+		}, 3000));
+		CHECK(back == data && in_order);
+
+		// A range of the file, and a callback that stops early.
+		back.clear();
+		CHECK(rw::readfile_chunks(name, [&](const char* chunk, size_t size, uint64_t) {
+			back.append(chunk, size);
+			return back.size() < 2000;
+		}, 1000, 500, 5000));
+		CHECK(back == data.substr(500, 2000));
+		CHECK(!rw::readfile_chunks("tests_missing.txt", [](const char*, size_t, uint64_t) { return true; }));
+		CHECK(rw::readfile(name, true, 9990) == data.substr(9990) && rw::readfile(name, true, 20000).empty());
+	});
+
+	// Offsets past 4 GiB do not wrap around in any of the file functions.
+	check("large/4gib_offsets", [&]() {
+		uint64_t size = (5ull << 30), middle = (4ull << 30) + 1;
+
+		make_sparse_file(name, size);
+		CHECK(rw::file_info(name).size == size);
+		CHECK(rw::readfile(name, true, size - 3) == "end");
+
+		rw::writefile(name, (void*)"mid", 3, (int64_t)middle, false);
+		CHECK(rw::readfile(name, true, middle, 3) == "mid" && rw::readfile(name, true, 0, 5) == "begin");
+
+		std::string chunks;
+		CHECK(rw::readfile_chunks(name, [&](const char* chunk, size_t n, uint64_t offset) {
+			CHECK(offset >= middle - 10);
+			chunks.append(chunk, n);
+			return true;
+		}, 1 << 20, middle - 10, 20));
+		CHECK(chunks == std::string(10, 0) + "mid" + std::string(7, 0));
+
+		rw::File file(name);
+		char buf[3];
+		CHECK(file.size() == size && file.pread(buf, 3, middle) == 3 && memcmp(buf, "mid", 3) == 0);
+	});
+
+	remove(name);
+}
+
+// Random simple text notation with the cases the parsers have to agree on: comments, empty values, names without values and multiline values.
+std::string make_document(std::mt19937& rng, size_t pieces)
+{
+	static const char* parts[] = { "a\n", "b\n", "\n", "# c\n", "a\nb\n", "x y\n", "a", "\n\n", "key\nval\n\n", "b\na\n",
+		"a\n[MULTILINE]\nb\n[END_MULTILINE]\n", "key\n[MULTILINE]\n\n# x\n[END_MULTILINE]\n", "[MULTILINE]\n", "\r\n" };
+	std::string doc;
+
+	for (size_t i = 0; i < pieces; i++)
+		doc += parts[rng() % (sizeof(parts) / sizeof(parts[0]))];
+
+	return doc;
+}
+
+// Check that a table of views has the same attributes as the map parse() returns.
+template<typename Table>
+bool same_attributes(const std::map<std::string, std::string>& expected, const Table& table)
+{
+	if (expected.size() != table.size()) {
+		return false;
+	}
+
+	for (const auto& [name, value] : expected) {
+		const std::string_view* found = table.find(name);
+
+		if (!found || *found != value) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// A struct with padding after its first field, which the per-field path of rw::Packed leaves out.
+struct Sample
+{
+	uint8_t channel;
+	double time;
+	float value;
+};
+
+struct Pair
+{
+	uint32_t a;
+	uint32_t b;
+};
+
+void check_streams()
+{
+	check("streams/read_write", [&]() {
+		rw::WriteStream ws;
+
+		ws.write<uint32_t>(7);
+		ws.put('x');
+		ws.write("abc", 3);
+		ws.pad(2);
+		CHECK(ws.size() == 10 && ws.pos == 10);
+
+		rw::ReadStream rs((const char*)ws.data(), ws.size());
+		char buf[8] = {};
+
+		CHECK(rs.read<uint32_t>() == 7 && rs.read<char>() == 'x');
+		CHECK(rs.read(buf, 3) == 3 && memcmp(buf, "abc", 3) == 0);
+		CHECK(rs.read(buf, 8) == 2 && rs.pos == rs.size && rs.read<uint32_t>() == 0);
+
+		std::string text = "name = value; other";
+		rw::ReadStream line(text.data(), text.size());
+
+		CHECK(line.readUntil(line.find(" = ")) == "name" && line.pos == 4);
+		line.pos += 3;
+		CHECK(line.readWhile([](char c) { return c != ';'; }) == "value" && line.readUntil(line.size) == " other");
+	});
+
+	check("streams/bulk", [&]() {
+		rw::WriteStream ws;
+
+		ws.write("0123456789", 10);
+		ws.pos = 2;
+		ws.write("ab", 2);
+		CHECK(ws.size() == 10 && ws.pos == 4 && memcmp(ws.data(), "01ab456789", 10) == 0);
+
+		ws.pos = ws.size();
+		ws.write<uint16_t>(0x4242);
+		CHECK(ws.size() == 12 && ws[10] == 0x42 && ws[11] == 0x42);
+
+		// Reads at the end are short, values past the end read as zero.
+		rw::ReadStream rs((const char*)ws.data(), ws.size());
+		char buf[16] = {};
+
+		CHECK(rs.read(buf, 4) == 4 && memcmp(buf, "01ab", 4) == 0);
+		CHECK(rs.read(buf, sizeof(buf)) == 8 && rs.pos == rs.size && rs.read(buf, 1) == 0);
+
+		rw::ReadStream tail("\x01", 1);
+		CHECK(tail.read<uint32_t>() == 1 && tail.pos == 1);
+	});
+
+	check("streams/prepare", [&]() {
+		rw::WriteStream ws;
+		ws.write<uint32_t>(7);
+
+		uint8_t* out = ws.prepare(16);
+		memset(out, 1, 4);
+		ws.put(9);
+		ws.commit(4);
+		CHECK(ws.size() == 5 && ws.pos == 5 && ws[4] == 9);
+
+		out = ws.prepare(8);
+		memset(out, 2, 3);
+		ws.commit(3);
+		CHECK(ws.size() == 8 && ws.pos == 8 && ws[7] == 2);
+
+		ws.prepare(100);
+		ws.prepare(2)[0] = 5;
+		ws.commit(1);
+		CHECK(ws.size() == 9 && ws[8] == 5);
+
+		std::vector<uint8_t> copy = ws.to_vector();
+		CHECK(copy.size() == ws.size() && std::equal(copy.begin(), copy.end(), ws.begin()));
+		CHECK((std::vector<uint8_t>)ws == copy);
+
+		// The buffer grows geometrically.
+		const uint8_t* data = ws.data();
+		size_t moves = 0;
+
+		for (int i = 0; i < 100000; i++) {
+			ws.put((uint8_t)i);
+
+			if (ws.data() != data) {
+				data = ws.data();
+				moves++;
+			}
+		}
+
+		CHECK(ws.size() == ws.pos && moves < 40);
+	});
+
+#if defined(__cpp_lib_memory_resource)
+	check("streams/allocators", [&]() {
+		std::pmr::monotonic_buffer_resource resource;
+		rw::pmr::WriteStream ws(&resource);
+
+		ws.write("name\nvalue\nlines\n[MULTILINE]\na\nb\n[END_MULTILINE]\n", 45);
+		CHECK(ws.size() == 45 && ws.get_allocator().resource() == &resource);
+
+		rw::ReadStream rs((const char*)ws.data(), ws.size());
+		std::map<std::string, std::string> expected = stn::parse(rs);
+		stn::pmr::Attributes attrs = stn::pmr::parse(rs, &resource);
+
+		CHECK(attrs.size() == expected.size() && attrs.get_allocator().resource() == &resource);
+
+		for (const auto& [name, value] : attrs) {
+			auto it = expected.find(std::string(name.data(), name.size()));
+			CHECK(it != expected.end() && std::string_view(it->second) == value);
+		}
+	});
+#endif
+
+	check("streams/read_lines", [&]() {
+		std::string text = "first\nsecond\n\nlast";
+		rw::ReadStream rs(text.data(), text.size());
+
+		CHECK(rs.readLine() == "first" && rs.readLine() == "second" && rs.readLine().empty());
+		CHECK(rs.readLine() == "last" && !rs);
+
+		rs.pos = 0;
+		CHECK(rs.readUntilByte('c') == "first\nse" && rs.readUntilByte('x') == "ond\n\nlast" && rs.pos == rs.size);
+
+		// The stop byte is skipped.
+		rs.pos = 0;
+		CHECK(rs.readWhile([](char c) { return c != '\n'; }) == "first" && rs.pos == 6);
+		CHECK(rs.readWhile([](char c) { return c >= 'a'; }) == "second" && rs.pos == 13);
+	});
+
+	check("streams/varints", [&]() {
+		std::mt19937_64 rng(16);
+
+		for (int i = 0; i < 2000; i++) {
+			// Values of every bit length, for every encoded length.
+			auto value = [&]() { return rng() >> (rng() % 64); };
+			std::vector<uint64_t> values(rng() % 20);
+			std::vector<uint32_t> packed(rng() % 40);
+			rw::WriteStream ws;
+
+			for (uint64_t& v : values)
+				v = value();
+
+			for (uint32_t& v : packed)
+				v = (uint32_t)value();
+
+			for (uint64_t v : values) {
+				ws.write_varint(v);
+				ws.write_zigzag((int64_t)v);
+			}
+
+			ws.write_varints(packed.data(), packed.size());
+			ws.write_le<uint32_t>(0x01020304);
+			ws.write_be<uint32_t>(0x01020304);
+
+			rw::ReadStream rs((const char*)ws.data(), ws.size());
+			std::vector<uint32_t> unpacked(packed.size());
+
+			for (uint64_t v : values) {
+				CHECK(rs.read_varint() == v);
+				CHECK(rs.read_zigzag() == (int64_t)v);
+			}
+
+			CHECK(rs.read_varints(unpacked.data(), unpacked.size()) && unpacked == packed);
+			CHECK(rs.read_le<uint32_t>() == 0x01020304 && rs.read_be<uint32_t>() == 0x01020304);
+			CHECK(rs.pos == rs.size);
+		}
+
+		rw::WriteStream ws;
+		ws.write_varint(~0ull);
+		CHECK(ws.size() == 10);
+
+		// A truncated varint reads as 0.
+		rw::ReadStream truncated((const char*)ws.data(), 9);
+		CHECK(truncated.read_varint() == 0 && truncated.pos == 9);
+
+		// The 10th byte may only hold bit 63, tryRead_varint() does not move the read position when it fails.
+		std::string longest = std::string(9, '\xFF') + '\x01', too_long = std::string(9, '\xFF') + '\x7F', too_many = std::string(10, '\xFF') + '\x01';
+		rw::ReadStream valid(longest.data(), longest.size()), invalid(too_long.data(), too_long.size()), overlong(too_many.data(), too_many.size());
+		uint64_t value = 1;
+
+		CHECK(valid.tryRead_varint(value) && value == ~0ull && valid.pos == 10);
+		CHECK(!invalid.tryRead_varint(value) && value == ~0ull && invalid.pos == 0);
+		CHECK(invalid.read_varint() == 0 && invalid.pos == 10);
+		CHECK(!overlong.tryRead_varint(value) && overlong.read_varint() == 0 && overlong.pos == 10);
+		CHECK(!truncated.tryRead_varint(value) && !valid.tryRead_varint(value) && valid.pos == 10);
+
+		uint32_t values[4] = { 1, 1000, 100000, 0xFFFFFFFF };
+		ws.pos = 0;
+		ws.clear();
+		ws.write_varints(values, 4);
+		CHECK(ws.size() == 1 + 1 + 2 + 3 + 4);
+
+		// No values take no bytes, even at the end of a stream.
+		rw::ReadStream end((const char*)ws.data() + ws.size(), 0);
+		CHECK(end.read_varints(values, 0));
+	});
+
+	check("streams/counters", [&]() {
+		std::string text = "name\nvalue\nother\nthing\n";
+		rw::ReadStream rs(text.data(), text.size());
+		char buf[8];
+
+		rw::reset_stats();
+		rs.read(buf, sizeof(buf));
+		CHECK(rw::stats().bytes_read == 8);
+
+		// Peeks are not reads.
+		rs.peek<uint32_t>();
+		rs.peekView(4);
+		CHECK(rw::stats().bytes_read == 8);
+
+		rw::WriteStream ws;
+		ws.write("abc", 3);
+		ws.write<uint32_t>(1);
+		CHECK(rw::stats().bytes_written == 7);
+
+		rw::find_sequence(text.data(), text.size(), "thing", 5);
+		CHECK(rw::stats().find_calls == 1);
+
+		rw::reset_stats();
+		stn::parse(rw::ReadStream(text.data(), text.size()));
+		CHECK(rw::stats().parse_keys == 2 && rw::stats().parse_lines >= 4);
+
+		// The hook sees the reads of a file.
+		static uint64_t hooked_bytes = 0;
+		const char* name = "tests_counters.txt";
+
+		rw::writefile(name, text.data(), text.size());
+		rw::reset_stats();
+		rw::set_io_hook([](const rw::IOEvent& event) {
+			if (event.op == rw::IOOp::read)
+				hooked_bytes += event.bytes;
+		});
+		rw::readfile(name, true);
+		rw::set_io_hook(nullptr);
+
+		CHECK(hooked_bytes == text.size());
+		CHECK(rw::stats().io_calls[(size_t)rw::IOOp::read] >= 1 && rw::stats().io_bytes[(size_t)rw::IOOp::read] == text.size());
+		remove(name);
+	});
+
+	check("streams/views", [&]() {
+		std::string data = "header" "record1" "tail";
+		rw::ReadStream rs(data.data(), data.size());
+
+		CHECK(rs.peekView(6) == "header" && rs.peek<char>() == 'h' && rs.pos == 0);
+		CHECK(rs.readView(6) == "header");
+
+		// A sub-stream cannot read past its end.
+		rw::ReadStream record = rs.subStream(7);
+		CHECK(record.size == 7 && record.pos == 0 && rs.pos == 13);
+		CHECK(record.readView(100) == "record1" && !record);
+
+		CHECK(rs.skip(2) == 2 && rs.peekView(10) == "il" && rs.readView(10) == "il");
+		CHECK(rs.skip(5) == 0 && rs.subStream(4).size == 0);
+
+		// Views and peeks at the end are short.
+		rs.pos = rs.size - 1;
+		CHECK(rs.peek<uint32_t>() == 'l' && rs.pos == rs.size - 1);
+		rs.pos = rs.size + 5;
+		CHECK(rs.peek<uint32_t>() == 0 && rs.peekView(3).empty() && rs.readView(3).empty());
+	});
+
+	check("streams/unchecked", [&]() {
+		rw::WriteStream ws;
+
+		for (uint32_t i = 0; i < 10; i++)
+			ws.write(i);
+
+		rw::ReadStream rs((const char*)ws.data(), ws.size());
+		uint32_t sum = 0;
+
+		CHECK(rs.ensure(40) && !rs.ensure(41));
+
+		if (rs.ensure(8 * sizeof(uint32_t))) {
+			for (int i = 0; i < 8; i++)
+				sum += rs.readUnchecked<uint32_t>();
+		}
+
+		CHECK(sum == 28 && rs.pos == 32);
+
+		// Failed reads do not move the read position.
+		uint32_t value = 0;
+		uint64_t big = 1;
+		char buf[8];
+
+		CHECK(rs.tryRead(value) && value == 8);
+		CHECK(!rs.tryRead(buf, 8) && !rs.tryRead(big) && big == 1 && rs.pos == 36);
+		CHECK(rs.tryRead(buf, 4) && rs.pos == 40 && !rs.tryRead(value));
+
+		rs.pos = rs.size + 1;
+		CHECK(!rs.ensure(0) && !rs.tryRead(buf, 0));
+	});
+
+	check("streams/packed", [&]() {
+		using SampleFields = rw::Packed<&Sample::channel, &Sample::time, &Sample::value>;
+		using PairFields = rw::Packed<&Pair::a, &Pair::b>;
+		using SwappedFields = rw::Packed<&Pair::b, &Pair::a>;
+
+		// Only fields in declaration order without padding are copied as a whole.
+		static_assert(SampleFields::size == 13 && PairFields::size == 8, "");
+		CHECK(PairFields::same_layout() && !SwappedFields::same_layout() && !SampleFields::same_layout());
+
+		std::vector<Sample> samples(100), back(101);
+		rw::WriteStream ws;
+
+		for (size_t i = 0; i < samples.size(); i++)
+			samples[i] = { (uint8_t)i, i * 0.5, i * 2.0f };
+
+		SampleFields::write_array(ws, samples.data(), samples.size());
+		CHECK(ws.size() == samples.size() * SampleFields::size);
+		SampleFields::write(ws, samples[7]);
+
+		rw::ReadStream rs((const char*)ws.data(), ws.size());
+		CHECK(SampleFields::read_array(rs, back.data(), back.size()) == back.size() && rs.pos == rs.size);
+
+		for (size_t i = 0; i < back.size(); i++) {
+			const Sample& s = samples[(i < samples.size()) ? i : 7];
+			CHECK(back[i].channel == s.channel && back[i].time == s.time && back[i].value == s.value);
+		}
+
+		// A value that does not fit is not read.
+		Sample sample = {};
+		rw::ReadStream short_rs((const char*)ws.data(), SampleFields::size - 1);
+		CHECK(!SampleFields::read(short_rs, sample) && short_rs.pos == 0 && sample.channel == 0);
+
+		// Swapped fields are written in the listed order, both paths read back what they wrote.
+		std::vector<Pair> pairs = { { 1, 2 }, { 3, 4 } }, pairs_back(2);
+		rw::WriteStream swapped, whole;
+
+		SwappedFields::write_array(swapped, pairs.data(), pairs.size());
+		PairFields::write_array(whole, pairs.data(), pairs.size());
+		CHECK(whole.size() == 16 && memcmp(whole.data(), pairs.data(), 16) == 0);
+
+		rw::ReadStream prs((const char*)swapped.data(), swapped.size());
+		CHECK(prs.read<uint32_t>() == 2 && prs.read<uint32_t>() == 1);
+		prs.pos = 0;
+		CHECK(SwappedFields::read_array(prs, pairs_back.data(), 2) == 2 && pairs_back[1].a == 3 && pairs_back[1].b == 4);
+
+		// Plain arrays read whole values only.
+		uint32_t values[16];
+		rw::ReadStream partial((const char*)whole.data(), 15);
+
+		CHECK(partial.read_into(values, 16) == 3 && values[2] == 3 && partial.pos == 12);
+		ws.write_array(values, 3);
+		CHECK(ws.size() == back.size() * SampleFields::size + 12);
+	});
+}
+
+void check_parse()
+{
+	check("parse/basic", [&]() {
+		std::string doc = "# comment\nname\nvalue\nempty\n\nlast\nx\n";
+		std::map<std::string, std::string> attrs = stn::parse(rw::ReadStream(doc.data(), doc.size()));
+
+		CHECK(attrs.size() == 3 && attrs["name"] == "value" && attrs["empty"] == "" && attrs["last"] == "x");
+		CHECK(stn::parse(rw::ReadStream(doc.data(), 0)).empty());
+	});
+
+	check("parse/parse_view", [&]() {
+		std::mt19937 rng(2);
+
+		for (int i = 0; i < 20000; i++) {
+			std::string doc = make_document(rng, rng() % 12);
+			rw::ReadStream rs(doc.data(), doc.size());
+			stn::AttributeTable table = stn::parse_view(rs);
+
+			CHECK(same_attributes(stn::parse(rs), table));
+
+			for (size_t k = 1; k < table.entries.size(); k++)
+				CHECK(table.entries[k - 1].first < table.entries[k].first);
+		}
+	});
+
+	check("parse/schema", [&]() {
+		static constexpr std::string_view names[] = { "width", "height", "title", "x", "y" };
+		static constexpr stn::Schema schema(names);
+		static_assert(schema.index("title") < 5 && schema.index("depth") == 5, "");
+
+		// Unknown names make parse_schema() fail, the known values are still filled in.
+		std::string doc = "width\n640\ntitle\nmain\ndepth\n3\nheight\n480\n";
+		stn::SchemaValues<5> values;
+
+		CHECK(!stn::parse_schema(rw::ReadStream(doc.data(), doc.size()), schema, values));
+		CHECK(values[schema.index("width")] == "640" && values[schema.index("height")] == "480" && values[schema.index("title")] == "main");
+		CHECK(!values[schema.index("x")] && !values[schema.index("y")]);
+
+		std::string known = "x\n1\ny\n\n";
+		stn::SchemaValues<5> known_values;
+
+		CHECK(stn::parse_schema(rw::ReadStream(known.data(), known.size()), schema, known_values));
+		CHECK(known_values[schema.index("x")] == "1" && known_values[schema.index("y")] == "" && !known_values[schema.index("width")]);
+
+		// A repeated name keeps its last value, like parse() does.
+		std::string repeated = "x\n1\ny\n2\nx\n3\n";
+		stn::SchemaValues<5> repeated_values;
+
+		CHECK(stn::parse_schema(rw::ReadStream(repeated.data(), repeated.size()), schema, repeated_values));
+		CHECK(repeated_values[schema.index("x")] == "3" && repeated_values[schema.index("y")] == "2");
+
+		// Schemas built at run time from random names give every name its own slot.
+		std::mt19937 rng(14);
+
+		auto slots = [&](auto count) {
+			constexpr size_t N = decltype(count)::value;
+
+			for (int i = 0; i < 500; i++) {
+				std::string storage[N];
+				std::string_view list[N];
+
+				for (size_t k = 0; k < N; k++) {
+					storage[k] = std::to_string(k) + "_" + std::to_string(rng() % 1000);
+					list[k] = storage[k];
+				}
+
+				stn::Schema<N> runtime(list);
+				std::vector<bool> taken(N);
+
+				for (std::string_view name : list) {
+					size_t slot = runtime.index(name);
+
+					CHECK(slot < N && !taken[slot]);
+					taken[std::min(slot, N - 1)] = true;
+				}
+
+				CHECK(runtime.index("missing") == N && runtime.index("") == N);
+
+				// A list with a repeated name is rejected.
+				if constexpr (N > 1) {
+					size_t first = rng() % N, second = (first + 1 + rng() % (N - 1)) % N;
+					bool rejected = false;
+
+					list[second] = list[first];
+
+					try {
+						stn::Schema<N> duplicate(list);
+					}
+					catch (const std::invalid_argument&) {
+						rejected = true;
+					}
+
+					CHECK(rejected);
+				}
+			}
+		};
+
+		slots(std::integral_constant<size_t, 1>());
+		slots(std::integral_constant<size_t, 7>());
+		slots(std::integral_constant<size_t, 64>());
+	});
+
+	check("parse/lazy_document", [&]() {
+		std::mt19937 rng(20);
+
+		for (int i = 0; i < 20000; i++) {
+			std::string doc = make_document(rng, rng() % 12);
+			rw::ReadStream rs(doc.data(), doc.size());
+			std::map<std::string, std::string> expected = stn::parse(rs);
+			stn::LazyDocument lazy(rs);
+
+			CHECK(same_attributes(expected, stn::parse_view(rs)));
+
+			for (const char* name : { "a", "b", "key", "x y", "", "# c", "val", "a\nb", "b\na", "[MULTILINE]" }) {
+				auto it = expected.find(name);
+				const std::string_view* found = lazy.find(name);
+
+				CHECK((it == expected.end()) ? !found : (found && *found == it->second));
+			}
+		}
+	});
+
+	check("parse/write", [&]() {
+		std::mt19937 rng(30);
+		static const char* parts[] = { "a", "b", " ", "#", "\n", "\r", "\r\n", "\n\n", "[MULTILINE]", "[END_MULTILINE]", "\n[END_MULTILINE]" };
+
+		auto text = [&](size_t count) {
+			std::string str;
+
+			for (size_t i = 0; i < count; i++)
+				str += parts[rng() % (sizeof(parts) / sizeof(parts[0]))];
+
+			return str;
+		};
+
+		for (int i = 0; i < 20000; i++) {
+			std::map<std::string, std::string> attrs;
+
+			for (size_t n = rng() % 6; n > 0; n--)
+				attrs[text(1 + rng() % 3)] = text(rng() % 5);
+
+			rw::WriteStream ws;
+			ws.write("x", 1);
+
+			// Written attributes parse back exactly, others fail without writing anything.
+			if (stn::write(attrs, ws)) {
+				rw::ReadStream rs((const char*)ws.data() + 1, ws.size() - 1);
+
+				CHECK(stn::parse(rs) == attrs);
+				CHECK(same_attributes(attrs, stn::parse_view(rs)));
+			}
+			else {
+				CHECK(ws.size() == 1);
+			}
+		}
+
+		std::map<std::string, std::string> attrs = { { "name", "value" }, { "lines", "first\n\nthird\n" }, { "empty", "" }, { "block", "[MULTILINE]" } };
+		rw::WriteStream ws;
+
+		CHECK(stn::write(attrs, ws) && stn::parse(rw::ReadStream((const char*)ws.data(), ws.size())) == attrs);
+		CHECK(!stn::write(std::map<std::string, std::string>{ { "#name", "value" } }, ws));
+		CHECK(!stn::write(std::map<std::string, std::string>{ { "", "value" } }, ws));
+		CHECK(!stn::write(std::map<std::string, std::string>{ { "name", "a\n[END_MULTILINE]\nb" } }, ws));
+	});
+
+	check("parse/stream_reader", [&]() {
+		std::mt19937 rng(8);
+
+		for (int i = 0; i < 5000; i++) {
+			std::string doc = make_document(rng, rng() % 30);
+			size_t at = 0, chunk_size = 1 + rng() % 16;
+
+			// Refills return fewer bytes than asked for, so lines and the multiline terminator are split between chunks.
+			rw::StreamReader sr([&](char* dest, size_t size) {
+				size_t n = std::min({ size, doc.size() - at, (size_t)(1 + rng() % 7) });
+
+				memcpy(dest, doc.data() + at, n);
+				at += n;
+				return n;
+			}, chunk_size);
+
+			CHECK(stn::parse(sr) == stn::parse(rw::ReadStream(doc.data(), doc.size())));
+		}
+	});
+
+	check("parse/watched_file", [&]() {
+		const char* name = "tests_watched.txt";
+		std::mt19937 rng(19);
+		std::string doc;
+
+		rw::writefile(name, doc.data(), doc.size());
+		stn::WatchedFile file(name, false);
+
+		// Random small edits, each reload only reparses the records around the change and must match a full parse.
+		for (int i = 0; i < 5000; i++) {
+			size_t at = doc.empty() ? 0 : rng() % (doc.size() + 1);
+
+			switch (rng() % 3) {
+			case 0: doc.insert(at, make_document(rng, 1)); break;
+			case 1: doc.erase(at, rng() % 8); break;
+			default: if (!doc.empty()) doc[std::min(at, doc.size() - 1)] = "ab\n#"[rng() % 4]; break;
+			}
+
+			if (doc.size() > 400)
+				doc = doc.substr(rng() % 100, 200);
+
+			rw::writefile(name, doc.data(), doc.size());
+			file.reload();
+
+			std::shared_ptr<const stn::WatchedFile::Snapshot> snapshot = file.snapshot();
+			CHECK(snapshot->data == doc && snapshot->table.entries == stn::parse_view(rw::ReadStream(doc.data(), doc.size())).entries);
+		}
+
+		// The watcher reloads a file that is replaced by a rename.
+		{
+			stn::WatchedFile live(name);
+			stn::WatchedFile::Reader reader(live);
+			uint64_t version = live.version();
+
+			rw::writefile("tests_watched.tmp", (void*)"hot\nreload\n", 11);
+			rename("tests_watched.tmp", name);
+
+			for (int i = 0; i < 200 && live.version() == version; i++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+			CHECK(reader.get()["hot"] == "reload");
+		}
+
+		remove(name);
+	});
+
+	check("parse/parallel", [&]() {
+		std::mt19937 rng(9);
+
+		// Chunks are at least 64 KiB, documents of a few hundred KiB are split between several threads.
+		for (int i = 0; i < 40; i++) {
+			std::string doc = make_document(rng, (i % 4 == 0) ? rng() % 50 : 20000 + rng() % 40000);
+			rw::ReadStream rs(doc.data(), doc.size());
+			std::map<std::string, std::string> expected = stn::parse(rs);
+			unsigned threads = 1 + rng() % 8;
+
+			CHECK(stn::parse_parallel(rs, threads) == expected);
+			CHECK(same_attributes(expected, stn::parse_view_parallel(rs, threads)));
+		}
+	});
+}
+
+void check_concat()
+{
+	check("concat/numbers", [&]() {
+		for (long long v : { 0ll, -1ll, 42ll, std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max() })
+			CHECK(std::string(rw::concat()(v)) == std::to_string(v));
+
+		for (double v : { 0.0, -1.5, 3.14159265, 123456.0, 1e300, -1e-300 })
+			CHECK(std::string(rw::concat()(v)) == std::to_string(v));
+
+		CHECK(std::string(rw::concat()(std::numeric_limits<unsigned long long>::max())) == std::to_string(std::numeric_limits<unsigned long long>::max()));
+		CHECK(std::string(rw::concat()(2.5f)) == std::to_string(2.5f));
+		CHECK(std::string(rw::concat()(true)(false)((unsigned char)200)((short)-7)) == "10200-7");
+		CHECK(std::string(rw::concat("a")(1)(' ')("b")(std::string("c"))(std::string_view("d"))('-', 3)) == "a1 bcd---");
+#if defined(__SIZEOF_INT128__) && !defined(__STRICT_ANSI__)
+		// With GNU extensions __int128 is an integral type, and needs more room than 64-bit integers.
+		__int128 max = (__int128)(~(unsigned __int128)0 >> 1);
+
+		CHECK(std::string(rw::concat()(max)) == "170141183460469231731687303715884105727");
+		CHECK(std::string(rw::concat()(-max - 1)) == "-170141183460469231731687303715884105728");
+		CHECK(std::string(rw::concat()(~(unsigned __int128)0)) == "340282366920938463463374607431768211455");
+#endif
+	});
+
+	check("concat/inline", [&]() {
+		rw::inline_concat<8> text("abc");
+
+		text(12345);
+		CHECK(text.view() == "abc12345");
+
+		// Longer text moves to the heap.
+		text(" and more text than fits");
+		CHECK(text.view() == "abc12345 and more text than fits" && std::string(text) == text.view());
+
+		rw::inline_concat<8> copy = text;
+		CHECK(copy.view() == text.view());
+	});
+}
+
+// Random data that is incompressible, text-like, or full of repeated matches.
+std::string make_data(std::mt19937& rng, size_t size, int kind)
+{
+	std::string data(size, 0);
+
+	for (size_t i = 0; i < size; i++) {
+		if (kind == 0)
+			data[i] = (char)rng();
+		else if (kind == 1)
+			data[i] = "abcab \n"[rng() % 7];
+		else
+			data[i] = (i > 100 && rng() % 4) ? data[i - 1 - rng() % 90] : (char)rng();
+	}
+
+	return data;
+}
+
+void check_compression()
+{
+	check("compression/lz_blocks", [&]() {
+		std::mt19937 rng(25);
+		rw::Codec lz = rw::lz_codec();
+
+		for (int i = 0; i < 2000; i++) {
+			size_t size = 1 + rng() % ((i % 10 == 0) ? 200000 : 300);
+			std::string data = make_data(rng, size, i % 3);
+			std::vector<char> packed(lz.bound(size)), unpacked(size);
+			size_t packed_size = lz.compress(data.data(), size, packed.data(), packed.size());
+
+			CHECK(packed_size != 0);
+			CHECK(lz.decompress(packed.data(), packed_size, unpacked.data(), size) == size && memcmp(unpacked.data(), data.data(), size) == 0);
+#if defined(RW_TEST_LZ4)
+			CHECK(LZ4_decompress_safe(packed.data(), unpacked.data(), (int)packed_size, (int)size) == (int)size && memcmp(unpacked.data(), data.data(), size) == 0);
+
+			std::vector<char> library(LZ4_compressBound((int)size));
+			int library_size = LZ4_compress_default(data.data(), library.data(), (int)size, (int)library.size());
+
+			CHECK(lz.decompress(library.data(), (size_t)library_size, unpacked.data(), size) == size && memcmp(unpacked.data(), data.data(), size) == 0);
+#endif
+			// Corrupt blocks fail or decompress to something, but never write out of bounds.
+			if (packed_size > 2) {
+				packed[rng() % packed_size] ^= (char)(1 << (rng() % 8));
+				lz.decompress(packed.data(), packed_size, unpacked.data(), size);
+			}
+
+			if (size > 20)
+				CHECK(lz.compress(data.data(), size, packed.data(), 5) == 0);
+		}
+	});
+
+	check("compression/frames", [&]() {
+		std::mt19937 rng(26);
+
+		for (int i = 0; i < 40; i++) {
+			size_t size = rng() % 500000, block_size = 1 + rng() % 70000;
+			std::string data = make_data(rng, size, i % 3);
+			rw::Codec codec = (i % 5 == 0) ? rw::stored_codec() : rw::lz_codec();
+			rw::WriteStream streamed, whole;
+
+			{
+				rw::CompressedWriter writer(rw::stream_sink(streamed), codec, block_size);
+
+				for (size_t at = 0; at < size;) {
+					size_t n = std::min<size_t>(size - at, rng() % 5000);
+
+					writer.write(data.data() + at, n);
+					at += n;
+				}
+			}
+
+			// Compressing on several threads gives the same frame as the streaming writer.
+			rw::compress(data.data(), size, whole, codec, block_size, 4);
+			CHECK(streamed.size() == whole.size() && memcmp(streamed.data(), whole.data(), whole.size()) == 0);
+
+			rw::CompressedView view(rw::ReadStream((const char*)streamed.data(), streamed.size()), codec);
+			CHECK(view && view.size() == size && view.decompress(3) == data);
+
+			for (int k = 0; k < 20; k++) {
+				uint64_t offset = size ? rng() % size : 0;
+				std::string part(rng() % 100000, 0);
+				size_t got = view.read(offset, part.data(), part.size());
+
+				CHECK(got == std::min<uint64_t>(part.size(), size - offset) && memcmp(part.data(), data.data() + offset, got) == 0);
+			}
+
+			size_t at = 0;
+			rw::StreamReader reader(rw::compressed_source([&](char* dest, size_t n) {
+				n = std::min({ n, streamed.size() - at, (size_t)(1 + rng() % 3000) });
+				memcpy(dest, streamed.data() + at, n);
+				at += n;
+				return n;
+			}, codec), 4096);
+			std::string back(size, 0);
+
+			CHECK(reader.read(back.data(), size) == size && back == data && !reader);
+			CHECK(!rw::CompressedView(rw::ReadStream((const char*)streamed.data(), streamed.size()), (i % 5 == 0) ? rw::lz_codec() : rw::stored_codec()));
+		}
+	});
+}
+
+void check_compiled()
+{
+	check("compiled/load_cached", [&]() {
+		const char* name = "tests_compiled.txt";
+		const char* cache_name = "tests_compiled.stnc";
+		std::string doc = "b\n2\na\n1\nc\n3\n";
+
+		rw::writefile(name, doc.data(), doc.size());
+		remove(cache_name);
+
+		stn::CompiledTable table;
+		CHECK(stn::load_cached(name, cache_name, table) && table.size() == 3 && table["b"] == "2");
+		CHECK(stn::CompiledTable(cache_name)["c"] == "3" && !table.count("d"));
+
+		// A cache with unsorted entries is rejected and compiled again.
+		std::string cache = rw::readfile(cache_name, true);
+		char* entries = &cache[sizeof(stn::CompiledHeader)];
+		std::swap_ranges(entries, entries + sizeof(stn::CompiledEntry), entries + sizeof(stn::CompiledEntry));
+		rw::writefile(cache_name, cache.data(), cache.size());
+
+		CHECK(!stn::CompiledTable(cache_name));
+		CHECK(stn::load_cached(name, cache_name, table) && table["a"] == "1" && table["b"] == "2");
+		CHECK(stn::CompiledTable(cache_name)["a"] == "1");
+
+		remove(name);
+		remove(cache_name);
+	});
+}
+
+void check_typed_values()
+{
+	check("typed/get", [&]() {
+		std::string doc = "width\n 1920\nscale\n+2.5\nfull\nYes\nbad\n12x\nlist\n1, 2,3\n";
+		rw::ReadStream rs(doc.data(), doc.size());
+
+		auto values = [](auto& attrs) {
+			std::vector<int> list;
+
+			CHECK(stn::get<int>(attrs, "width") == 1920);
+			CHECK(stn::get<double>(attrs, "scale") == 2.5);
+			CHECK(stn::get<bool>(attrs, "full"));
+			CHECK(stn::get<int>(attrs, "bad", -1) == -1 && stn::get<int>(attrs, "missing", -2) == -2);
+			CHECK(stn::get_list(attrs, "list", list) && list == std::vector<int>({ 1, 2, 3 }));
+		};
+
+		std::map<std::string, std::string> map = stn::parse(rs);
+		stn::AttributeTable table = stn::parse_view(rs);
+		stn::TypedTable typed(stn::parse_view(rs));
+
+		values(map);
+		values(table);
+#if defined(__cpp_lib_memory_resource)
+		std::pmr::monotonic_buffer_resource resource;
+		stn::pmr::Attributes pmr_map = stn::pmr::parse(rs, &resource);
+
+		values(pmr_map);
+#endif
+		CHECK(typed.get<int>("width") == 1920 && typed.get<int>(typed.index("width")) == 1920);
+	});
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2) {
+		std::cout << "USAGE: " << argv[0] << " [filter]\n";
+		std::cout << "Runs the checks whose names contain [filter], \"large\" runs the checks with files of more than 1 GB.";
+		return 0;
+	}
+
+	if (argc > 1)
+		filter = argv[1];
+
+	check_search();
+	check_async_io();
+	check_logger();
+	check_files();
+	check_streams();
+	check_parse();
+	check_concat();
+	check_compression();
+	check_compiled();
+	check_typed_values();
+
+	printf("%s\n", (failures) ? "FAILED" : "all checks passed");
+	return (failures) ? 1 : 0;
+}